@@ -0,0 +1,183 @@
+#include "stdafx.h"
+
+#include <string>
+#include <utility>
+
+#include "AlertChannel.h"
+
+namespace {
+
+// max time between wake ups of the delivery thread, pushing alerts doesn't lock the mutex so notification can be lost
+constexpr std::chrono::milliseconds kDeliveryCheckPeriod(100);
+
+// alert about the alerts which were not delivered because of the rate limit or queue overflow
+TelegramAlert createDroppedAlert(size_t droppedCount)
+{
+    TelegramAlert alert;
+    alert.code = TelegramAlertCode::eAlertsDropped;
+    alert.timestamp = std::chrono::system_clock::now();
+    alert.repeatCount = droppedCount;
+    return alert;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------//
+TelegramAlert createAlert(TelegramAlertCode code, const std::exception& error, int64_t chatId /*= 0*/)
+{
+    TelegramAlert alert;
+    alert.code = code;
+    alert.chatId = chatId;
+    alert.timestamp = std::chrono::system_clock::now();
+    alert.details = error.what();
+    if (const auto* telegramError = dynamic_cast<const TgBot::TgException*>(&error))
+        alert.httpStatus = static_cast<int>(telegramError->errorCode);
+    return alert;
+}
+
+//----------------------------------------------------------------------------//
+AlertChannel::AlertChannel(TelegramAlertHandler handler)
+    : m_handler(std::move(handler))
+    , m_rateLimitPeriodStart(std::chrono::steady_clock::now())
+{
+    m_deliveryThread.run([this]() { deliveryThread(); });
+}
+
+//----------------------------------------------------------------------------//
+AlertChannel::~AlertChannel()
+{
+    m_stopRequested = true;
+    m_wakeUp.notify_one();
+
+    if (m_deliveryThread.joinable())
+        m_deliveryThread.interrupt_and_join();
+}
+
+//----------------------------------------------------------------------------//
+void AlertChannel::Push(TelegramAlert&& alert)
+{
+    if (!m_handler)
+        return;
+
+    if (m_queue.TryPush(std::move(alert)))
+        m_wakeUp.notify_one();
+    else
+        ++m_droppedAlerts;
+}
+
+//----------------------------------------------------------------------------//
+void AlertChannel::deliveryThread()
+{
+    while (true)
+    {
+        // check stop before draining the queue so alerts pushed before stop are delivered
+        const bool stop = m_stopRequested;
+        const auto now = std::chrono::steady_clock::now();
+
+        TelegramAlert alert;
+        while (m_queue.TryPop(alert))
+        {
+            processAlert(std::move(alert), now);
+        }
+        m_rateLimitedAlerts += m_droppedAlerts.exchange(0);
+        flushRepeatedAlerts(now, stop);
+        // dropped alerts are reported when the minute is over even if no new alerts come
+        updateRateLimitPeriod(now);
+
+        if (stop)
+            break;
+
+        std::unique_lock<std::mutex> lock(m_wakeUpMutex);
+        m_wakeUp.wait_for(lock, kDeliveryCheckPeriod);
+    }
+}
+
+//----------------------------------------------------------------------------//
+void AlertChannel::processAlert(TelegramAlert&& alert, std::chrono::steady_clock::time_point now)
+{
+    RepeatedAlert& repeatedAlert = m_repeatedAlerts[AlertKey(alert.code, alert.httpStatus, alert.chatId, alert.details)];
+    if (repeatedAlert.lastDelivery != std::chrono::steady_clock::time_point() &&
+        now - repeatedAlert.lastDelivery < kDeduplicationWindow)
+    {
+        repeatedAlert.alert = std::move(alert);
+        ++repeatedAlert.suppressedCount;
+        return;
+    }
+
+    repeatedAlert.lastDelivery = now;
+    deliver(std::move(alert), now);
+}
+
+//----------------------------------------------------------------------------//
+void AlertChannel::flushRepeatedAlerts(std::chrono::steady_clock::time_point now, bool force)
+{
+    for (auto it = m_repeatedAlerts.begin(); it != m_repeatedAlerts.end();)
+    {
+        RepeatedAlert& repeatedAlert = it->second;
+        if (!force && now - repeatedAlert.lastDelivery < kDeduplicationWindow)
+        {
+            ++it;
+            continue;
+        }
+
+        if (repeatedAlert.suppressedCount == 0)
+        {
+            it = m_repeatedAlerts.erase(it);
+            continue;
+        }
+
+        TelegramAlert alert = std::move(repeatedAlert.alert);
+        alert.repeatCount = repeatedAlert.suppressedCount;
+        repeatedAlert.suppressedCount = 0;
+        repeatedAlert.lastDelivery = now;
+        deliver(std::move(alert), now, force);
+        ++it;
+    }
+
+    if (force && m_rateLimitedAlerts != 0)
+        deliver(createDroppedAlert(std::exchange(m_rateLimitedAlerts, 0)), now, true);
+}
+
+//----------------------------------------------------------------------------//
+void AlertChannel::deliver(TelegramAlert&& alert, std::chrono::steady_clock::time_point now, bool ignoreRateLimit /*= false*/)
+{
+    updateRateLimitPeriod(now);
+
+    if (!ignoreRateLimit && m_deliveredInPeriod >= kMaxAlertsPerMinute)
+    {
+        ++m_rateLimitedAlerts;
+        return;
+    }
+
+    ++m_deliveredInPeriod;
+    callHandler(alert);
+}
+
+//----------------------------------------------------------------------------//
+void AlertChannel::updateRateLimitPeriod(std::chrono::steady_clock::time_point now)
+{
+    if (now - m_rateLimitPeriodStart < std::chrono::minutes(1))
+        return;
+
+    m_rateLimitPeriodStart = now;
+    m_deliveredInPeriod = 0;
+
+    if (m_rateLimitedAlerts != 0)
+    {
+        ++m_deliveredInPeriod;
+        callHandler(createDroppedAlert(std::exchange(m_rateLimitedAlerts, 0)));
+    }
+}
+
+//----------------------------------------------------------------------------//
+void AlertChannel::callHandler(const TelegramAlert& alert)
+{
+    try
+    {
+        m_handler(alert);
+    }
+    catch (const std::exception& e)
+    {
+        OutputDebugStringA(("Alert handler failed: " + std::string(e.what()) + "\n").c_str());
+    }
+}
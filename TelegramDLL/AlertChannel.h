@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include <ext/thread/thread.h>
+
+#include "TelegramThread.h"
+
+//----------------------------------------------------------------------------//
+// bounded lock-free queue for many producers and one consumer, based on the Dmitry Vyukov's MPMC queue
+template <typename T, size_t Capacity>
+class LockFreeRingBuffer
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+public:
+    LockFreeRingBuffer()
+    {
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // add item to the queue, returns false if the queue is full
+    bool TryPush(T&& item)
+    {
+        size_t position = m_pushPosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = m_cells[position & (Capacity - 1)];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0)
+            {
+                if (m_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.data = std::move(item);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+                return false;
+            else
+                position = m_pushPosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    // take item from the queue, returns false if the queue is empty
+    bool TryPop(T& item)
+    {
+        size_t position = m_popPosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = m_cells[position & (Capacity - 1)];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0)
+            {
+                if (m_popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    item = std::move(cell.data);
+                    cell.sequence.store(position + Capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+                return false;
+            else
+                position = m_popPosition.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+    std::array<Cell, Capacity> m_cells;
+    // positions are kept on separate cache lines to avoid false sharing between producers and consumer
+    alignas(64) std::atomic<size_t> m_pushPosition = 0;
+    alignas(64) std::atomic<size_t> m_popPosition = 0;
+};
+
+//----------------------------------------------------------------------------//
+// create alert from the exception, takes the HTTP status from the Telegram errors
+TelegramAlert createAlert(TelegramAlertCode code, const std::exception& error, int64_t chatId = 0);
+
+//----------------------------------------------------------------------------//
+// delivers alerts to the handler from the separate thread, so slow handler never stalls the bot threads
+// - pushing an alert doesn't take locks and doesn't format anything
+// - same alerts(code, HTTP status, chat and details) repeated within a minute are delivered once with repeats count
+// - no more than kMaxAlertsPerMinute alerts are delivered per minute, the rest are dropped and reported later
+class AlertChannel
+{
+public:
+    explicit AlertChannel(TelegramAlertHandler handler);
+    // delivers alerts left in the queue
+    ~AlertChannel();
+
+    // add alert to the delivery queue, never blocks
+    void Push(TelegramAlert&& alert);
+
+private:
+    // delivery thread function
+    void deliveryThread();
+    // deduplicate and deliver alert
+    void processAlert(TelegramAlert&& alert, std::chrono::steady_clock::time_point now);
+    // deliver repeats of the alerts which deduplication window is over
+    void flushRepeatedAlerts(std::chrono::steady_clock::time_point now, bool force);
+    // pass alert to the handler if rate limit allows
+    void deliver(TelegramAlert&& alert, std::chrono::steady_clock::time_point now, bool ignoreRateLimit = false);
+    // start the new rate limit period when the minute is over and report alerts dropped in the previous one
+    void updateRateLimitPeriod(std::chrono::steady_clock::time_point now);
+    // pass alert to the handler, handler errors are only traced
+    void callHandler(const TelegramAlert& alert);
+
+private:
+    static constexpr size_t kQueueCapacity = 1024;
+    static constexpr size_t kMaxAlertsPerMinute = 30;
+    static constexpr std::chrono::minutes kDeduplicationWindow{ 1 };
+
+    const TelegramAlertHandler m_handler;
+
+    LockFreeRingBuffer<TelegramAlert, kQueueCapacity> m_queue;
+    // alerts which didn't fit into the queue
+    std::atomic<size_t> m_droppedAlerts = 0;
+
+    // wakes up the delivery thread, used only for sleeping, pushing doesn't lock the mutex
+    std::mutex m_wakeUpMutex;
+    std::condition_variable m_wakeUp;
+    std::atomic<bool> m_stopRequested = false;
+
+    // state of the same alerts for the deduplication, used only by the delivery thread
+    struct RepeatedAlert
+    {
+        std::chrono::steady_clock::time_point lastDelivery;
+        // last suppressed alert
+        TelegramAlert alert;
+        size_t suppressedCount = 0;
+    };
+    typedef std::tuple<TelegramAlertCode, int, int64_t, std::string> AlertKey;
+    std::map<AlertKey, RepeatedAlert> m_repeatedAlerts;
+
+    // start of the current rate limit minute and alerts delivered in it, used only by the delivery thread
+    std::chrono::steady_clock::time_point m_rateLimitPeriodStart;
+    size_t m_deliveredInPeriod = 0;
+    size_t m_rateLimitedAlerts = 0;
+
+    // thread delivering alerts
+    ext::thread m_deliveryThread;
+};
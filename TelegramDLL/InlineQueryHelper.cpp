@@ -0,0 +1,416 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <string>
+
+#include "InlineQueryHelper.h"
+
+namespace {
+
+// lower case without spaces at the ends and with single spaces between words
+std::wstring normalizeQuery(const std::wstring& query)
+{
+    std::wstring normalized;
+    normalized.reserve(query.size());
+
+    bool spaceNeeded = false;
+    for (const wchar_t symbol : query)
+    {
+        if (std::iswspace(symbol))
+        {
+            spaceNeeded = !normalized.empty();
+            continue;
+        }
+        if (spaceNeeded)
+        {
+            normalized += L' ';
+            spaceNeeded = false;
+        }
+        normalized += symbol;
+    }
+    // std::towlower depends on the C locale, system function lowercases letters of any language
+    if (!normalized.empty())
+        ::CharLowerBuffW(&normalized[0], static_cast<DWORD>(normalized.size()));
+    return normalized;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------//
+InlineQueryHelper::InlineQueryHelper(const TgBot::Api& api, ErrorHandler errorHandler)
+    : m_api(api)
+    , m_errorHandler(std::move(errorHandler))
+{}
+
+//----------------------------------------------------------------------------//
+InlineQueryHelper::~InlineQueryHelper()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = true;
+    }
+    m_workChanged.notify_all();
+    m_answersChanged.notify_all();
+
+    for (auto& thread : m_computeThreads)
+    {
+        if (thread.joinable())
+            thread.interrupt_and_join();
+    }
+    for (auto& thread : m_answerThreads)
+    {
+        if (thread.joinable())
+            thread.interrupt_and_join();
+    }
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::SetProvider(InlineQueryResultsProvider provider, const InlineQueryOptions& options)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_provider = std::move(provider);
+        m_options = options;
+        m_cache.clear();
+        m_cacheIndex.clear();
+        m_queryUsage.clear();
+    }
+
+    if (m_computeThreads.front().joinable())
+    {
+        m_workChanged.notify_all();
+        return;
+    }
+
+    for (auto& thread : m_computeThreads)
+    {
+        thread.run([this]() { computeThread(); });
+    }
+    for (auto& thread : m_answerThreads)
+    {
+        thread.run([this]() { answerThread(); });
+    }
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::OnInlineQuery(const TgBot::InlineQuery::Ptr& query)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const int64_t userId = query->from->id;
+    PendingQuery pendingQuery;
+    pendingQuery.query = query;
+    pendingQuery.offset = query->offset;
+    pendingQuery.normalizedQuery = normalizeQuery(getUNICODEString(query->query));
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_provider)
+            return;
+
+        // cancel computation of the previous user query
+        pendingQuery.generation = m_userGenerations[userId] = ++m_lastGeneration;
+
+        // cached results are answered without waiting for the next keystroke and for the computing threads
+        const std::wstring key = getCacheKey(pendingQuery.normalizedQuery, pendingQuery.offset, userId);
+        InlineQueryResults results;
+        if (findInCache(key, now, results))
+        {
+            m_pendingQueries.erase(userId);
+            planAnswer(key, std::move(pendingQuery), std::move(results));
+            return;
+        }
+
+        // next pages of the results are computed without debounce
+        pendingQuery.dueTime = query->offset.empty() ? now + m_options.debounceTime : now;
+        m_pendingQueries[userId] = std::move(pendingQuery);
+    }
+    m_workChanged.notify_one();
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::Precompute(const std::list<std::wstring>& queries)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& query : queries)
+        {
+            m_precomputeQueue.emplace_back(normalizeQuery(query));
+        }
+    }
+    m_workChanged.notify_one();
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::computeThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopRequested)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const auto nextQuery = std::min_element(m_pendingQueries.begin(), m_pendingQueries.end(),
+                                                [](const auto& left, const auto& right)
+                                                {
+                                                    return left.second.dueTime < right.second.dueTime;
+                                                });
+        if (nextQuery != m_pendingQueries.end() && nextQuery->second.dueTime <= now)
+        {
+            PendingQuery pendingQuery = std::move(nextQuery->second);
+            m_pendingQueries.erase(nextQuery);
+            processQuery(lock, std::move(pendingQuery));
+        }
+        else if (nextQuery == m_pendingQueries.end() && !m_precomputeQueue.empty())
+        {
+            std::wstring normalizedQuery = std::move(m_precomputeQueue.front());
+            m_precomputeQueue.pop_front();
+            precomputeQuery(lock, std::move(normalizedQuery));
+        }
+        else if (nextQuery != m_pendingQueries.end())
+            m_workChanged.wait_until(lock, nextQuery->second.dueTime);
+        else
+            m_workChanged.wait(lock);
+    }
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::answerThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopRequested)
+    {
+        if (m_answers.empty())
+        {
+            m_answersChanged.wait(lock);
+            continue;
+        }
+
+        Answer answer = std::move(m_answers.front());
+        m_answers.pop_front();
+
+        // Telegram shows only the results of the last query
+        const int64_t userId = answer.query->from->id;
+        if (isSuperseded(userId, answer.generation))
+            continue;
+        if (m_pendingQueries.find(userId) == m_pendingQueries.end())
+            m_userGenerations.erase(userId);
+
+        const auto cacheTime = static_cast<int32_t>(m_options.cacheTime.count());
+        const bool isPersonal = m_options.isPersonal;
+        lock.unlock();
+
+        try
+        {
+            m_api.answerInlineQuery(answer.query->id, answer.results.results, cacheTime, isPersonal,
+                                    answer.results.nextOffset);
+        }
+        catch (const std::exception& e)
+        {
+            if (m_errorHandler)
+                m_errorHandler(e);
+        }
+
+        lock.lock();
+    }
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::processQuery(std::unique_lock<std::mutex>& lock, PendingQuery&& pendingQuery)
+{
+    const int64_t userId = pendingQuery.query->from->id;
+    const std::wstring key = getCacheKey(pendingQuery.normalizedQuery, pendingQuery.offset, userId);
+    InlineQueryResults results;
+    if (!findInCache(key, std::chrono::steady_clock::now(), results))
+    {
+        const InlineQueryResultsProvider provider = m_provider;
+        lock.unlock();
+
+        bool computed = false;
+        // results can be incomplete if the provider was told about cancellation
+        bool cancelled = false;
+        try
+        {
+            results = provider(pendingQuery.normalizedQuery, pendingQuery.offset, pendingQuery.query, [&]()
+            {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                cancelled = cancelled || isSuperseded(userId, pendingQuery.generation);
+                return cancelled;
+            });
+            computed = true;
+        }
+        catch (const std::exception& e)
+        {
+            if (m_errorHandler)
+                m_errorHandler(e);
+        }
+
+        lock.lock();
+        if (!computed)
+            return;
+
+        // complete results are useful for the next queries even if this one is superseded
+        if (!cancelled)
+            putToCache(key, results, std::chrono::steady_clock::now());
+    }
+
+    if (isSuperseded(userId, pendingQuery.generation))
+        return;
+
+    planAnswer(key, std::move(pendingQuery), std::move(results));
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::planAnswer(const std::wstring& key, PendingQuery&& pendingQuery, InlineQueryResults&& results)
+{
+    // popularity is counted by the first pages, the next ones are requested by the same users
+    if (pendingQuery.offset.empty())
+        countQueryUsage(key, pendingQuery.normalizedQuery);
+
+    m_answers.push_back(Answer{ std::move(pendingQuery.query), std::move(results), pendingQuery.generation });
+    m_answersChanged.notify_one();
+}
+
+//----------------------------------------------------------------------------//
+bool InlineQueryHelper::isSuperseded(int64_t userId, uint64_t generation) const
+{
+    if (m_stopRequested)
+        return true;
+
+    // generation is removed after the answer, so the earlier queries are superseded too
+    const auto it = m_userGenerations.find(userId);
+    return it == m_userGenerations.end() || it->second != generation;
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::precomputeQuery(std::unique_lock<std::mutex>& lock, std::wstring&& normalizedQuery)
+{
+    // personal results can't be computed without the user
+    if (m_options.isPersonal)
+        return;
+
+    // only the first page is precomputed, users rarely scroll the results
+    const std::wstring key = getCacheKey(normalizedQuery, std::string(), 0);
+    InlineQueryResults results;
+    if (findInCache(key, std::chrono::steady_clock::now(), results))
+        return;
+
+    // precomputation gives way to the user queries
+    const auto isCancelled = [&]()
+    {
+        return m_stopRequested || !m_pendingQueries.empty();
+    };
+
+    const InlineQueryResultsProvider provider = m_provider;
+    lock.unlock();
+
+    bool computed = false;
+    // results can be incomplete if the provider was told about cancellation
+    bool cancelled = false;
+    try
+    {
+        results = provider(normalizedQuery, std::string(), nullptr, [&]()
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            cancelled = cancelled || isCancelled();
+            return cancelled;
+        });
+        computed = true;
+    }
+    catch (const std::exception& e)
+    {
+        if (m_errorHandler)
+            m_errorHandler(e);
+    }
+
+    lock.lock();
+    if (!computed)
+        return;
+
+    if (cancelled)
+    {
+        // try again when users stop typing
+        if (!m_stopRequested)
+            m_precomputeQueue.emplace_back(std::move(normalizedQuery));
+        return;
+    }
+
+    putToCache(key, results, std::chrono::steady_clock::now());
+}
+
+//----------------------------------------------------------------------------//
+std::wstring InlineQueryHelper::getCacheKey(const std::wstring& normalizedQuery, const std::string& offset,
+                                            int64_t userId) const
+{
+    // normalized query has no line breaks, so the offset can't be mixed up with the query text
+    std::wstring key = normalizedQuery;
+    if (!offset.empty())
+        key += L'\n' + getUNICODEString(offset);
+    if (m_options.isPersonal)
+        return std::to_wstring(userId) + L':' + key;
+    return key;
+}
+
+//----------------------------------------------------------------------------//
+bool InlineQueryHelper::findInCache(const std::wstring& key, std::chrono::steady_clock::time_point now,
+                                    InlineQueryResults& results)
+{
+    const auto it = m_cacheIndex.find(key);
+    if (it == m_cacheIndex.end())
+        return false;
+
+    if (it->second->expireTime <= now)
+    {
+        m_cache.erase(it->second);
+        m_cacheIndex.erase(it);
+        return false;
+    }
+
+    m_cache.splice(m_cache.begin(), m_cache, it->second);
+    results = it->second->results;
+    return true;
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::putToCache(const std::wstring& key, const InlineQueryResults& results,
+                                   std::chrono::steady_clock::time_point now)
+{
+    if (m_options.cacheSize == 0)
+        return;
+
+    const auto expireTime = now + m_options.cacheTime;
+    const auto it = m_cacheIndex.find(key);
+    if (it != m_cacheIndex.end())
+    {
+        it->second->results = results;
+        it->second->expireTime = expireTime;
+        m_cache.splice(m_cache.begin(), m_cache, it->second);
+        return;
+    }
+
+    m_cache.push_front(CacheEntry{ key, results, expireTime });
+    m_cacheIndex.emplace(key, m_cache.begin());
+
+    while (m_cache.size() > m_options.cacheSize)
+    {
+        m_cacheIndex.erase(m_cache.back().key);
+        m_cache.pop_back();
+    }
+}
+
+//----------------------------------------------------------------------------//
+void InlineQueryHelper::countQueryUsage(const std::wstring& key, const std::wstring& normalizedQuery)
+{
+    if (m_options.popularQueryThreshold == 0 || m_options.isPersonal)
+        return;
+
+    if (m_queryUsage.size() >= kMaxCountedQueries && m_queryUsage.find(key) == m_queryUsage.end())
+        m_queryUsage.clear();
+
+    if (++m_queryUsage[key] != m_options.popularQueryThreshold)
+        return;
+
+    // users type the popular query letter by letter, prepare results for each step
+    for (size_t length = 1; length < normalizedQuery.size(); ++length)
+    {
+        if (normalizedQuery[length - 1] != L' ')
+            m_precomputeQueue.emplace_back(normalizedQuery.substr(0, length));
+    }
+}
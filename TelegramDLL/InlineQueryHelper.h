@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <ext/thread/thread.h>
+
+#include "TelegramThread.h"
+
+//----------------------------------------------------------------------------//
+// answers inline queries from own threads:
+// - query is handled only when the user stops typing for the debounce time, earlier queries of the user are dropped
+// - results are computed by a few threads and answers are sent by other ones,
+//   so cached results are answered without waiting for computation of other users queries
+// - computation of the query superseded by the new one is cancelled via isCancelled callback,
+//   results computed without cancellation are cached even if the query is superseded
+// - results are kept in the LRU cache by the normalized query and page offset for the cache time
+// - pages requested by scrolling the results are computed without debounce
+// - when query becomes popular, results for its prefixes are computed in background while there are no queries
+class InlineQueryHelper
+{
+public:
+    // callback on the query handling error
+    typedef std::function<void(const std::exception& error)> ErrorHandler;
+
+    InlineQueryHelper(const TgBot::Api& api, ErrorHandler errorHandler);
+    ~InlineQueryHelper();
+
+    // set results provider and options, clears the cache
+    void SetProvider(InlineQueryResultsProvider provider, const InlineQueryOptions& options);
+
+    // handle query from the user, never blocks on network or results computation
+    void OnInlineQuery(const TgBot::InlineQuery::Ptr& query);
+
+    // compute results of the queries in background and put them to the cache
+    void Precompute(const std::list<std::wstring>& queries);
+
+private:
+    // query waiting for the user to stop typing
+    struct PendingQuery
+    {
+        TgBot::InlineQuery::Ptr query;
+        std::wstring normalizedQuery;
+        // offset of the requested page, empty for the first page
+        std::string offset;
+        std::chrono::steady_clock::time_point dueTime;
+        // generation of the user queries, query is superseded when the generation changes
+        uint64_t generation = 0;
+    };
+    // results waiting to be sent to the user
+    struct Answer
+    {
+        TgBot::InlineQuery::Ptr query;
+        InlineQueryResults results;
+        uint64_t generation = 0;
+    };
+    // computed page of the query results
+    struct CacheEntry
+    {
+        std::wstring key;
+        InlineQueryResults results;
+        std::chrono::steady_clock::time_point expireTime;
+    };
+    typedef std::list<CacheEntry> Cache;
+
+    // computing thread function
+    void computeThread();
+    // answering thread function
+    void answerThread();
+    // compute results if needed and plan the answer, called with the locked mutex
+    void processQuery(std::unique_lock<std::mutex>& lock, PendingQuery&& pendingQuery);
+    // count the query usage and plan sending of the results, called with the locked mutex
+    void planAnswer(const std::wstring& key, PendingQuery&& pendingQuery, InlineQueryResults&& results);
+    // check if the user sent a new query after the one with the generation, called with the locked mutex
+    bool isSuperseded(int64_t userId, uint64_t generation) const;
+    // compute results for the cache, called with the locked mutex
+    void precomputeQuery(std::unique_lock<std::mutex>& lock, std::wstring&& normalizedQuery);
+
+    // get cache key of the query results page
+    std::wstring getCacheKey(const std::wstring& normalizedQuery, const std::string& offset, int64_t userId) const;
+    // find not expired results in the cache and move them to the front
+    bool findInCache(const std::wstring& key, std::chrono::steady_clock::time_point now, InlineQueryResults& results);
+    // put results to the cache, the least recently used results are removed on overflow
+    void putToCache(const std::wstring& key, const InlineQueryResults& results, std::chrono::steady_clock::time_point now);
+    // count the query usage and plan precomputation of its prefixes when it becomes popular
+    void countQueryUsage(const std::wstring& key, const std::wstring& normalizedQuery);
+
+private:
+    // max number of queries which usage is counted
+    static constexpr size_t kMaxCountedQueries = 10000;
+    // number of the queries computed in parallel, slow provider call of one user doesn't hold the others
+    static constexpr size_t kComputeThreadsCount = 2;
+    // number of the answers sent in parallel, the request round trip doesn't hold the computation
+    static constexpr size_t kAnswerThreadsCount = 2;
+
+    const TgBot::Api& m_api;
+    const ErrorHandler m_errorHandler;
+
+    std::mutex m_mutex;
+    std::condition_variable m_workChanged;
+    std::condition_variable m_answersChanged;
+    bool m_stopRequested = false;
+
+    InlineQueryResultsProvider m_provider;
+    InlineQueryOptions m_options;
+
+    // the last query of each user
+    std::map<int64_t, PendingQuery> m_pendingQueries;
+    // current queries generation of each user, generations are unique among all users
+    std::unordered_map<int64_t, uint64_t> m_userGenerations;
+    uint64_t m_lastGeneration = 0;
+    // results to send
+    std::deque<Answer> m_answers;
+    // queries to compute when there is nothing else to do
+    std::deque<std::wstring> m_precomputeQueue;
+
+    // results ordered from the most to the least recently used
+    Cache m_cache;
+    std::unordered_map<std::wstring, Cache::iterator> m_cacheIndex;
+    // number of queries by the cache key
+    std::unordered_map<std::wstring, size_t> m_queryUsage;
+
+    // threads computing results and answering queries, started with the first provider
+    std::array<ext::thread, kComputeThreadsCount> m_computeThreads;
+    std::array<ext::thread, kAnswerThreadsCount> m_answerThreads;
+};
@@ -0,0 +1,501 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cwchar>
+#include <cwctype>
+#include <vector>
+
+#include "MessageSplitter.h"
+
+namespace {
+
+// markup of the message text
+enum class Markup
+{
+    eNone,
+    eHtml,
+    eMarkdown,
+    eMarkdownV2
+};
+
+// formatting entity open at the current position
+struct OpenEntity
+{
+    std::wstring openingMarkup;
+    std::wstring closingMarkup;
+};
+
+// index of the entity node meaning no open entities
+constexpr size_t kNoEntity = static_cast<size_t>(-1);
+
+// entity in the stack of the open entities, stacks of different positions share their bottoms,
+// so the position keeps its stack by the index of the top node without copying
+struct EntityNode
+{
+    OpenEntity entity;
+    // node of the entity below, kNoEntity for the bottom one
+    size_t parent = kNoEntity;
+    // this entity or one of the entities below is code, spaces and line breaks inside it are kept
+    bool code = false;
+};
+
+// indivisible part of the text
+struct Token
+{
+    enum class Type
+    {
+        eText,      // text shown to the user
+        eOpen,      // opening of the formatting entity
+        eClose      // closing of the formatting entity
+    };
+    Type type = Type::eText;
+    // length in the source text
+    size_t length = 1;
+    // UTF-16 units shown to the user
+    size_t visibleLength = 1;
+    // opened or closed entity
+    OpenEntity entity;
+};
+
+//----------------------------------------------------------------------------//
+Markup getMarkup(std::string parseMode)
+{
+    std::transform(parseMode.begin(), parseMode.end(), parseMode.begin(),
+                   [](char symbol) { return static_cast<char>(::tolower(static_cast<unsigned char>(symbol))); });
+    if (parseMode == "html")
+        return Markup::eHtml;
+    if (parseMode == "markdown")
+        return Markup::eMarkdown;
+    if (parseMode == "markdownv2")
+        return Markup::eMarkdownV2;
+    return Markup::eNone;
+}
+
+//----------------------------------------------------------------------------//
+bool isHighSurrogate(wchar_t symbol)
+{
+    return (symbol & 0xFC00) == 0xD800;
+}
+
+//----------------------------------------------------------------------------//
+bool isLowSurrogate(wchar_t symbol)
+{
+    return (symbol & 0xFC00) == 0xDC00;
+}
+
+//----------------------------------------------------------------------------//
+bool isCodeEntity(const OpenEntity& entity)
+{
+    return entity.closingMarkup == L"</pre>" || entity.closingMarkup == L"</code>" ||
+        entity.closingMarkup == L"`" || entity.closingMarkup == L"```";
+}
+
+//----------------------------------------------------------------------------//
+// splits text to the parts in one pass, remembering the last line break and space as the possible cut positions
+class MessageSplitter
+{
+public:
+    MessageSplitter(const std::wstring& text, Markup markup, size_t maxLength)
+        : m_text(text)
+        , m_markup(markup)
+        , m_maxLength(maxLength)
+    {}
+
+    std::list<std::wstring> Split()
+    {
+        for (size_t position = 0; position < m_text.size();)
+        {
+            const Token token = readToken(position);
+            if (token.type == Token::Type::eText)
+            {
+                const bool isBreak = token.length == 1 && (m_text[position] == L'\n' || m_text[position] == L' ');
+                // the rest of the breaks run cut at the end of the previous part is dropped
+                if (isBreak && m_dropBreaks && position == m_partStart)
+                {
+                    ++m_partStart;
+                    ++position;
+                    continue;
+                }
+
+                if (isBreak && isInCode(m_entities))
+                {
+                    // code keeps its indentation, only the line break at the cut is dropped,
+                    // space after the word is kept at the start of the next part
+                    const bool lineBreak = m_text[position] == L'\n';
+                    if (lineBreak || m_textEnd == position)
+                        (lineBreak ? m_lineBreak : m_spaceBreak) =
+                            BreakPoint{ true, position, m_visibleLength, m_entities, lineBreak ? size_t(1) : size_t(0), m_textEnd > m_partStart };
+                    m_breakRun.valid = false;
+                }
+                else if (isBreak)
+                {
+                    // the whole run of breaks is dropped on the cut, so the cut is made at its start
+                    if (!m_breakRun.valid || m_breakRun.position + m_breakRun.length != position)
+                        m_breakRun = BreakPoint{ true, position, m_visibleLength, m_entities, 0, m_textEnd > m_partStart };
+                    ++m_breakRun.length;
+                    (m_text[position] == L'\n' ? m_lineBreak : m_spaceBreak) = m_breakRun;
+                    for (BreakPoint* breakPoint : { &m_lineBreak, &m_spaceBreak })
+                    {
+                        if (breakPoint->valid && breakPoint->position == m_breakRun.position)
+                            breakPoint->length = m_breakRun.length;
+                    }
+                }
+
+                if (m_visibleLength + token.visibleLength > m_maxLength && m_visibleLength != 0)
+                {
+                    cut(position);
+                    // the break can be at the very start of the part, then the token still doesn't fit
+                    if (m_visibleLength + token.visibleLength > m_maxLength && m_visibleLength != 0)
+                        cut(position);
+                }
+
+                if (!isBreak && token.visibleLength != 0)
+                    m_textEnd = position + token.length;
+            }
+
+            if (position >= m_partStart)
+                m_dropBreaks = false;
+            applyToken(token);
+            position += token.length;
+        }
+
+        // the rest can contain only closing markup
+        if (m_visibleLength != 0 && m_textEnd > m_partStart)
+            m_parts.emplace_back(m_partPrefix + m_text.substr(m_partStart));
+        return std::move(m_parts);
+    }
+
+private:
+    // possible cut position, the break symbols themselves are dropped
+    struct BreakPoint
+    {
+        bool valid = false;
+        size_t position = 0;
+        // visible length of the part before the break
+        size_t visibleLength = 0;
+        // top of the entities open at the break
+        size_t entities = kNoEntity;
+        // number of the dropped break symbols
+        size_t length = 1;
+        // part before the break has text besides breaks
+        bool hasText = false;
+    };
+
+    // finish the current part before the current position
+    void cut(size_t position)
+    {
+        const BreakPoint* breakPoint = nullptr;
+        // don't make the part too short if there is no line break in its second half
+        if (m_lineBreak.valid && m_lineBreak.visibleLength >= m_maxLength / 2)
+            breakPoint = &m_lineBreak;
+        else if (m_spaceBreak.valid)
+            breakPoint = &m_spaceBreak;
+        else if (m_lineBreak.valid)
+            breakPoint = &m_lineBreak;
+
+        if (breakPoint)
+            finishPart(breakPoint->position, breakPoint->length, breakPoint->visibleLength, breakPoint->entities, breakPoint->hasText);
+        else
+            finishPart(position, 0, m_visibleLength, m_entities, m_textEnd > m_partStart);
+    }
+
+    // part of breaks only is not sent, Telegram rejects such messages as empty
+    void finishPart(size_t cutPosition, size_t skipLength, size_t partVisibleLength, size_t entities, bool hasText)
+    {
+        // entities from the innermost one
+        std::vector<const OpenEntity*> openEntities;
+        for (size_t node = entities; node != kNoEntity; node = m_entityNodes[node].parent)
+        {
+            openEntities.push_back(&m_entityNodes[node].entity);
+        }
+
+        if (hasText)
+        {
+            std::wstring part = m_partPrefix;
+            part.append(m_text, m_partStart, cutPosition - m_partStart);
+            for (const OpenEntity* entity : openEntities)
+            {
+                part += entity->closingMarkup;
+            }
+            m_parts.emplace_back(std::move(part));
+        }
+
+        m_partPrefix.clear();
+        for (auto it = openEntities.rbegin(), end = openEntities.rend(); it != end; ++it)
+        {
+            m_partPrefix += (*it)->openingMarkup;
+        }
+
+        m_partStart = cutPosition + skipLength;
+        m_visibleLength -= partVisibleLength + skipLength;
+        m_lineBreak.valid = m_spaceBreak.valid = m_breakRun.valid = false;
+        // the next part must not start with breaks, part of spaces only is rejected by Telegram
+        m_dropBreaks = skipLength != 0 && !isInCode(entities);
+    }
+
+    void applyToken(const Token& token)
+    {
+        switch (token.type)
+        {
+        case Token::Type::eText:
+            m_visibleLength += token.visibleLength;
+            break;
+        case Token::Type::eOpen:
+            pushEntity(token.entity);
+            break;
+        case Token::Type::eClose:
+            closeEntity(token.entity.closingMarkup);
+            break;
+        }
+    }
+
+    void pushEntity(const OpenEntity& entity)
+    {
+        const bool code = isInCode(m_entities) || isCodeEntity(entity);
+        m_entityNodes.push_back(EntityNode{ entity, m_entities, code });
+        m_entities = m_entityNodes.size() - 1;
+    }
+
+    // close the innermost entity with the closing markup, entities opened inside it stay open
+    void closeEntity(const std::wstring& closingMarkup)
+    {
+        std::vector<size_t> innerEntities;
+        size_t node = m_entities;
+        while (node != kNoEntity && m_entityNodes[node].entity.closingMarkup != closingMarkup)
+        {
+            innerEntities.push_back(node);
+            node = m_entityNodes[node].parent;
+        }
+        if (node == kNoEntity)
+            return;
+
+        m_entities = m_entityNodes[node].parent;
+        for (auto it = innerEntities.rbegin(), end = innerEntities.rend(); it != end; ++it)
+        {
+            // copy, the node can move on the nodes growth
+            const OpenEntity entity = m_entityNodes[*it].entity;
+            pushEntity(entity);
+        }
+    }
+
+    bool isInCode(size_t entities) const
+    {
+        return entities != kNoEntity && m_entityNodes[entities].code;
+    }
+
+    Token readToken(size_t position) const
+    {
+        switch (m_markup)
+        {
+        case Markup::eHtml:
+            return readHtmlToken(position);
+        case Markup::eMarkdown:
+        case Markup::eMarkdownV2:
+            return readMarkdownToken(position);
+        default:
+            return readSymbol(position);
+        }
+    }
+
+    // one symbol shown to the user, surrogate pair is one symbol
+    Token readSymbol(size_t position) const
+    {
+        Token token;
+        if (isHighSurrogate(m_text[position]) && position + 1 < m_text.size() && isLowSurrogate(m_text[position + 1]))
+            token.length = token.visibleLength = 2;
+        return token;
+    }
+
+    Token readHtmlToken(size_t position) const
+    {
+        const wchar_t symbol = m_text[position];
+        if (symbol == L'<')
+        {
+            const size_t tagEnd = m_text.find(L'>', position);
+            if (tagEnd == std::wstring::npos)
+                return readSymbol(position);
+
+            Token token;
+            token.length = tagEnd - position + 1;
+            token.visibleLength = 0;
+
+            const bool closing = position + 1 < tagEnd && m_text[position + 1] == L'/';
+            const size_t nameStart = position + (closing ? 2 : 1);
+            size_t nameEnd = nameStart;
+            while (nameEnd < tagEnd && (std::iswalnum(m_text[nameEnd]) || m_text[nameEnd] == L'-'))
+            {
+                ++nameEnd;
+            }
+            std::wstring name = m_text.substr(nameStart, nameEnd - nameStart);
+            std::transform(name.begin(), name.end(), name.begin(), [](wchar_t nameSymbol) { return static_cast<wchar_t>(std::towlower(nameSymbol)); });
+
+            token.type = closing ? Token::Type::eClose : Token::Type::eOpen;
+            token.entity.closingMarkup = L"</" + name + L">";
+            if (!closing)
+                token.entity.openingMarkup = m_text.substr(position, token.length);
+            return token;
+        }
+
+        if (symbol == L'&')
+        {
+            // &amp; &lt; &gt; &quot; or numeric entity, shown as one symbol
+            constexpr size_t kMaxEntityLength = 10;
+            const size_t entityEnd = m_text.find(L';', position);
+            if (entityEnd != std::wstring::npos && entityEnd - position <= kMaxEntityLength &&
+                std::all_of(m_text.begin() + position + 1, m_text.begin() + entityEnd,
+                            [](wchar_t entitySymbol) { return std::iswalnum(entitySymbol) || entitySymbol == L'#'; }))
+            {
+                Token token;
+                token.length = entityEnd - position + 1;
+                // numeric entity out of BMP takes surrogate pair
+                if (position + 1 < entityEnd && m_text[position + 1] == L'#')
+                {
+                    const bool hex = position + 2 < entityEnd && (m_text[position + 2] == L'x' || m_text[position + 2] == L'X');
+                    const std::wstring code = m_text.substr(position + (hex ? 3 : 2), entityEnd - position - (hex ? 3 : 2));
+                    if (!code.empty() && std::wcstoul(code.c_str(), nullptr, hex ? 16 : 10) > 0xFFFF)
+                        token.visibleLength = 2;
+                }
+                return token;
+            }
+        }
+
+        return readSymbol(position);
+    }
+
+    Token readMarkdownToken(size_t position) const
+    {
+        const bool v2 = m_markup == Markup::eMarkdownV2;
+        const auto startsWith = [&](const wchar_t* markup)
+        {
+            return m_text.compare(position, wcslen(markup), markup) == 0;
+        };
+        const auto makeToggle = [&](const std::wstring& marker)
+        {
+            Token token;
+            token.length = marker.size();
+            token.visibleLength = 0;
+            token.entity.openingMarkup = token.entity.closingMarkup = marker;
+            bool opened = false;
+            for (size_t node = m_entities; node != kNoEntity && !opened; node = m_entityNodes[node].parent)
+            {
+                opened = m_entityNodes[node].entity.closingMarkup == marker;
+            }
+            token.type = opened ? Token::Type::eClose : Token::Type::eOpen;
+            return token;
+        };
+        const auto readEscaped = [&]()
+        {
+            Token token = readSymbol(position + 1);
+            token.length += 1;
+            return token;
+        };
+
+        const wchar_t symbol = m_text[position];
+
+        // inside code only its end and escapes are special
+        if (isInCode(m_entities))
+        {
+            const std::wstring& codeEnd = m_entityNodes[m_entities].entity.closingMarkup;
+            if (v2 && symbol == L'\\' && position + 1 < m_text.size())
+                return readEscaped();
+            if (startsWith(codeEnd.c_str()))
+                return makeToggle(codeEnd);
+            return readSymbol(position);
+        }
+
+        if (symbol == L'\\' && position + 1 < m_text.size() &&
+            (v2 || wcschr(L"_*`[", m_text[position + 1]) != nullptr))
+            return readEscaped();
+
+        if (startsWith(L"```"))
+        {
+            Token token = makeToggle(L"```");
+            // language of the code block is a part of the opening markup: ```cpp\n
+            size_t languageEnd = position + 3;
+            while (languageEnd < m_text.size() && (std::iswalnum(m_text[languageEnd]) || wcschr(L"_+-#", m_text[languageEnd]) != nullptr))
+            {
+                ++languageEnd;
+            }
+            if (languageEnd < m_text.size() && m_text[languageEnd] == L'\n')
+            {
+                token.length = languageEnd - position + 1;
+                token.entity.openingMarkup = m_text.substr(position, token.length);
+            }
+            return token;
+        }
+        if (symbol == L'`')
+            return makeToggle(L"`");
+        if (v2 && startsWith(L"||"))
+            return makeToggle(L"||");
+        if (v2 && startsWith(L"__"))
+            return makeToggle(L"__");
+        if (symbol == L'*' || symbol == L'_' || (v2 && symbol == L'~'))
+            return makeToggle(std::wstring(1, symbol));
+
+        if (symbol == L'[')
+        {
+            // link [text](url) is never cut, escaped ) doesn't end the url of MarkdownV2
+            const size_t textEnd = m_text.find(L"](", position);
+            size_t linkEnd = std::wstring::npos;
+            for (size_t urlPosition = textEnd == std::wstring::npos ? m_text.size() : textEnd + 2;
+                 urlPosition < m_text.size(); ++urlPosition)
+            {
+                if (v2 && m_text[urlPosition] == L'\\')
+                    ++urlPosition;
+                else if (m_text[urlPosition] == L')')
+                {
+                    linkEnd = urlPosition;
+                    break;
+                }
+            }
+            if (linkEnd != std::wstring::npos)
+            {
+                Token token;
+                token.length = linkEnd - position + 1;
+                token.visibleLength = textEnd - position - 1;
+                return token;
+            }
+        }
+
+        return readSymbol(position);
+    }
+
+private:
+    const std::wstring& m_text;
+    const Markup m_markup;
+    const size_t m_maxLength;
+
+    std::list<std::wstring> m_parts;
+    // start of the current part in the text
+    size_t m_partStart = 0;
+    // opening markup of the entities open at the start of the current part
+    std::wstring m_partPrefix;
+    // visible length of the current part
+    size_t m_visibleLength = 0;
+    // nodes of the open entities stacks, only grow while the text is split
+    std::vector<EntityNode> m_entityNodes;
+    // top of the entities open at the current position
+    size_t m_entities = kNoEntity;
+
+    BreakPoint m_lineBreak;
+    BreakPoint m_spaceBreak;
+    // the last run of breaks in a row
+    BreakPoint m_breakRun;
+    // breaks at the start of the current part are dropped
+    bool m_dropBreaks = false;
+    // end of the last visible text which is not a break
+    size_t m_textEnd = 0;
+};
+
+} // namespace
+
+//----------------------------------------------------------------------------//
+std::list<std::wstring> splitMessage(const std::wstring& text, const std::string& parseMode,
+                                     size_t maxLength /*= kMaxMessageLength*/)
+{
+    // markup is never shown, so the text fits if its full length fits
+    if (text.size() <= maxLength)
+        return { text };
+
+    return MessageSplitter(text, getMarkup(parseMode), maxLength).Split();
+}
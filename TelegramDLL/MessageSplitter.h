@@ -0,0 +1,17 @@
+#pragma once
+
+#include <list>
+#include <string>
+
+// max length of the message text after entities parsing, see https://core.telegram.org/bots/api#sendmessage
+constexpr size_t kMaxMessageLength = 4096;
+
+// split message to parts with no more than maxLength UTF-16 units of the text shown to the user
+// parts are cut on the line break, on the space or between characters if there is no break in the part,
+// the whole run of line breaks and spaces at the cut is dropped, so no part consists of them only,
+// inside code only the line break at the cut is dropped to keep the indentation,
+// surrogate pairs, HTML tags and entities, Markdown escapes and links are never cut,
+// formatting entities open at the cut are closed at the end of the part and reopened in the next one
+// parseMode - Telegram parse mode: "", "HTML", "Markdown" or "MarkdownV2"
+std::list<std::wstring> splitMessage(const std::wstring& text, const std::string& parseMode,
+                                     size_t maxLength = kMaxMessageLength);
@@ -0,0 +1,554 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <ext/core/check.h>
+
+#include "OutboundQueue.h"
+
+namespace {
+
+size_t laneIndex(MessagePriority priority)
+{
+    return static_cast<size_t>(priority);
+}
+
+// Telegram refuses edits which don't change the message, this is not an error for the live message
+bool isMessageNotModifiedError(const std::exception& error)
+{
+    return strstr(error.what(), "message is not modified") != nullptr;
+}
+
+// bad request and forbidden errors repeat on retry: message is deleted or too old to edit, chat is gone, bot is blocked
+bool isRetryableError(const std::exception& error)
+{
+    const auto* telegramError = dynamic_cast<const TgBot::TgException*>(&error);
+    if (telegramError == nullptr)
+        return true;
+
+    const int httpStatus = static_cast<int>(telegramError->errorCode);
+    return httpStatus != 400 && httpStatus != 403;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------//
+OutboundQueue::OutboundQueue(const TgBot::Api& api, SendErrorHandler errorHandler, DropHandler dropHandler)
+    : m_api(api)
+    , m_errorHandler(std::move(errorHandler))
+    , m_dropHandler(std::move(dropHandler))
+{
+    for (auto& thread : m_senderThreads)
+    {
+        thread.run([this]() { senderThread(); });
+    }
+}
+
+//----------------------------------------------------------------------------//
+OutboundQueue::~OutboundQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = true;
+        m_stopDeadline = std::chrono::steady_clock::now() + kStopTimeout;
+    }
+    m_queueChanged.notify_all();
+    m_rateLimitChanged.notify_all();
+
+    for (auto& thread : m_senderThreads)
+    {
+        if (thread.joinable())
+            thread.interrupt_and_join();
+    }
+
+    if (m_droppedMessagesCount != 0 && m_dropHandler)
+        m_dropHandler(m_droppedMessagesCount);
+}
+
+//----------------------------------------------------------------------------//
+void OutboundQueue::Push(MessagePriority priority, std::list<Message>&& messages)
+{
+    if (messages.empty())
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto& lane = m_lanes[laneIndex(priority)];
+        for (auto& message : messages)
+        {
+            lane.messages.push_back(QueuedMessage{ std::move(message), now });
+        }
+    }
+    // messages to different chats can be sent in parallel
+    if (messages.size() > 1)
+        m_queueChanged.notify_all();
+    else
+        m_queueChanged.notify_one();
+}
+
+//----------------------------------------------------------------------------//
+uint64_t OutboundQueue::CreatePartsGroupId()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return ++m_lastPartsGroupId;
+}
+
+//----------------------------------------------------------------------------//
+void OutboundQueue::SetRateLimit(uint32_t messagesPerSecond)
+{
+    EXT_ASSERT(messagesPerSecond != 0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_messagesPerSecond = std::max<uint32_t>(messagesPerSecond, 1);
+        m_availableTokens = std::min<double>(m_availableTokens, m_messagesPerSecond);
+    }
+    m_rateLimitChanged.notify_all();
+}
+
+//----------------------------------------------------------------------------//
+void OutboundQueue::PublishLiveMessage(int64_t chatId, int32_t messageId, std::string&& text,
+                                       const std::string& parseMode, TgBot::GenericReply::Ptr replyMarkup)
+{
+    std::string replyMarkupJson = replyMarkup ? m_typeParser.parseGenericReply(replyMarkup) : std::string();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        LiveMessage& liveMessage = m_liveMessages[LiveMessageId(chatId, messageId)];
+        const bool sameAsSent = text == liveMessage.sentText && parseMode == liveMessage.sentParseMode &&
+            replyMarkupJson == liveMessage.sentReplyMarkupJson;
+        if (!liveMessage.hasUnsentText && !sameAsSent)
+            liveMessage.publishTime = std::chrono::steady_clock::now();
+
+        liveMessage.text = std::move(text);
+        liveMessage.parseMode = parseMode;
+        liveMessage.replyMarkup = std::move(replyMarkup);
+        liveMessage.replyMarkupJson = std::move(replyMarkupJson);
+        // last writer wins, the text returned to the sent one doesn't need an edit
+        liveMessage.hasUnsentText = !sameAsSent;
+        liveMessage.removeRequested = false;
+    }
+    m_queueChanged.notify_one();
+}
+
+//----------------------------------------------------------------------------//
+void OutboundQueue::RemoveLiveMessage(int64_t chatId, int32_t messageId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto it = m_liveMessages.find(LiveMessageId(chatId, messageId));
+    if (it == m_liveMessages.end())
+        return;
+
+    if (it->second.hasUnsentText || it->second.editInProgress)
+        it->second.removeRequested = true;
+    else
+        m_liveMessages.erase(it);
+}
+
+//----------------------------------------------------------------------------//
+void OutboundQueue::SetLiveMessageInterval(std::chrono::milliseconds interval)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_liveMessageInterval = interval;
+    }
+    m_queueChanged.notify_one();
+}
+
+//----------------------------------------------------------------------------//
+SendLaneStatistics OutboundQueue::GetStatistics(MessagePriority priority) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto& lane = m_lanes[laneIndex(priority)];
+    SendLaneStatistics statistics = lane.statistics;
+    statistics.queuedCount = lane.messages.size();
+    return statistics;
+}
+
+//----------------------------------------------------------------------------//
+void OutboundQueue::senderThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (waitForWork(lock))
+    {
+        if (!waitForRateBudget(lock))
+            continue;
+
+        // what to send is chosen after the rate budget wait, so a critical message pushed
+        // while we were waiting goes first
+        OutgoingMessage outgoing;
+        if (!takeNextMessage(std::chrono::steady_clock::now(), outgoing))
+            continue;
+
+        m_availableTokens -= 1.;
+        m_chatsInFlight.insert(outgoing.queuedMessage.message.chatId);
+        lock.unlock();
+
+        const Message& message = outgoing.queuedMessage.message;
+        bool sent = false;
+        bool retryable = true;
+        try
+        {
+            if (outgoing.editedMessageId != 0)
+                m_api.editMessageText(message.text, message.chatId, outgoing.editedMessageId, "",
+                                      message.parseMode, message.disableWebPagePreview, message.replyMarkup);
+            else
+                m_api.sendMessage(message.chatId, message.text, message.disableWebPagePreview,
+                                  message.replyToMessageId, message.replyMarkup,
+                                  message.parseMode, message.disableNotification);
+            sent = true;
+        }
+        catch (const std::exception& e)
+        {
+            if (outgoing.editedMessageId != 0 && isMessageNotModifiedError(e))
+                sent = true;
+            else
+            {
+                retryable = isRetryableError(e);
+                // the report with a gap in the middle is misleading, so the rest of it is not sent
+                const size_t droppedPartsCount = dropNextParts(message);
+                if (m_errorHandler)
+                    m_errorHandler(message, e, droppedPartsCount);
+            }
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(now - outgoing.queuedMessage.enqueueTime);
+
+        lock.lock();
+        m_chatsInFlight.erase(message.chatId);
+        // next messages to the chat can be sent by any sender now
+        m_queueChanged.notify_all();
+
+        if (outgoing.editedMessageId != 0)
+            completeLiveMessageEdit(LiveMessageId(message.chatId, outgoing.editedMessageId), sent, retryable, now);
+
+        Lane& lane = m_lanes[outgoing.lane];
+        if (sent)
+        {
+            ++lane.statistics.sentCount;
+            lane.totalLatency += latency;
+            lane.statistics.averageLatency = lane.totalLatency / lane.statistics.sentCount;
+            lane.statistics.maxLatency = (std::max)(lane.statistics.maxLatency, latency);
+        }
+        else
+            ++lane.statistics.failedCount;
+    }
+}
+
+//----------------------------------------------------------------------------//
+bool OutboundQueue::takeNextMessage(std::chrono::steady_clock::time_point now, OutgoingMessage& outgoing)
+{
+    if (takeLaneMessage(MessagePriority::eCritical, outgoing))
+        return true;
+
+    // on stop the messages left in the queue are sent in priority order until the stop deadline
+    if (m_stopRequested)
+    {
+        return takeLaneMessage(MessagePriority::eNormal, outgoing) ||
+            takeLiveMessageEdit(now, outgoing) ||
+            takeLaneMessage(MessagePriority::eBulk, outgoing);
+    }
+
+    // each source sends up to its weight in a round, the round is over when
+    // all sources which have messages to send have used their weights
+    for (int round = 0; round < 2; ++round)
+    {
+        for (size_t source = 0; source < kSourceWeights.size(); ++source)
+        {
+            if (m_sentInRound[source] >= kSourceWeights[source])
+                continue;
+
+            bool taken = false;
+            switch (static_cast<Source>(source))
+            {
+            case Source::eNormalLane:
+                taken = takeLaneMessage(MessagePriority::eNormal, outgoing);
+                break;
+            case Source::eBulkLane:
+                taken = takeLaneMessage(MessagePriority::eBulk, outgoing);
+                break;
+            case Source::eLiveMessages:
+                taken = takeLiveMessageEdit(now, outgoing);
+                break;
+            default:
+                EXT_ASSERT(false && "Unknown message source");
+                break;
+            }
+
+            if (taken)
+            {
+                ++m_sentInRound[source];
+                return true;
+            }
+        }
+
+        m_sentInRound.fill(0);
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------//
+bool OutboundQueue::takeLaneMessage(MessagePriority priority, OutgoingMessage& outgoing)
+{
+    Lane& lane = m_lanes[laneIndex(priority)];
+    const auto message = findSendableMessage(lane);
+    if (message == lane.messages.end())
+        return false;
+
+    outgoing.queuedMessage = std::move(*message);
+    outgoing.lane = laneIndex(priority);
+    outgoing.editedMessageId = 0;
+    lane.messages.erase(message);
+    return true;
+}
+
+//----------------------------------------------------------------------------//
+bool OutboundQueue::takeLiveMessageEdit(std::chrono::steady_clock::time_point now, OutgoingMessage& outgoing)
+{
+    const auto liveMessage = findDueLiveMessage(now);
+    if (liveMessage == m_liveMessages.end())
+        return false;
+
+    LiveMessage& state = liveMessage->second;
+    Message& message = outgoing.queuedMessage.message;
+    message.chatId = liveMessage->first.first;
+    message.text = state.text;
+    message.parseMode = state.parseMode;
+    message.replyMarkup = state.replyMarkup ? state.replyMarkup : std::make_shared<TgBot::GenericReply>();
+    outgoing.queuedMessage.enqueueTime = state.publishTime;
+    // live message edits are accounted in the normal lane
+    outgoing.lane = laneIndex(MessagePriority::eNormal);
+    outgoing.editedMessageId = liveMessage->first.second;
+
+    state.hasUnsentText = false;
+    state.editInProgress = true;
+    state.sentText = state.text;
+    state.sentParseMode = state.parseMode;
+    state.sentReplyMarkupJson = state.replyMarkupJson;
+    state.nextEditTime = now + m_liveMessageInterval;
+    m_lastEditedLiveMessage = liveMessage->first;
+    return true;
+}
+
+//----------------------------------------------------------------------------//
+void OutboundQueue::completeLiveMessageEdit(const LiveMessageId& id, bool sent, bool retryable,
+                                            std::chrono::steady_clock::time_point now)
+{
+    const auto liveMessage = m_liveMessages.find(id);
+    // dropped on stop
+    if (liveMessage == m_liveMessages.end())
+        return;
+
+    LiveMessage& state = liveMessage->second;
+    state.editInProgress = false;
+    if (sent)
+        state.failedEditsCount = 0;
+    else
+    {
+        // the removed message is not retried, the edit may never succeed
+        if (state.removeRequested)
+        {
+            m_liveMessages.erase(liveMessage);
+            return;
+        }
+
+        // the message content is unknown now, so the next published text is sent even if it equals the failed one
+        state.sentText.clear();
+        state.sentParseMode.clear();
+        state.sentReplyMarkupJson.clear();
+
+        ++state.failedEditsCount;
+        if (retryable && state.failedEditsCount <= kMaxEditRetriesCount && !m_stopRequested)
+        {
+            state.hasUnsentText = true;
+            state.nextEditTime = now + m_liveMessageInterval * (size_t(1) << (std::min)(state.failedEditsCount, kMaxEditRetryIntervalPower));
+        }
+        else
+        {
+            // the failed text is dropped, a text published during the edit is still sent
+            state.failedEditsCount = 0;
+        }
+    }
+
+    if (state.removeRequested && !state.hasUnsentText)
+        m_liveMessages.erase(liveMessage);
+}
+
+//----------------------------------------------------------------------------//
+bool OutboundQueue::waitForWork(std::unique_lock<std::mutex>& lock)
+{
+    while (true)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (m_stopRequested && now >= m_stopDeadline)
+        {
+            dropUnsentMessages();
+            return false;
+        }
+
+        if (hasSendableMessages(now))
+            return true;
+
+        // messages to the chats being sent are left to the senders of these chats
+        if (m_stopRequested && !hasUnsentMessages())
+            return false;
+
+        // sending of the message wakes us up, because the next message to the same chat can be sent after it
+        auto wakeUpTime = getNextLiveMessageEditTime();
+        if (m_stopRequested)
+            wakeUpTime = (std::min)(wakeUpTime, m_stopDeadline);
+
+        if (wakeUpTime == (std::chrono::steady_clock::time_point::max)())
+            m_queueChanged.wait(lock);
+        else
+            m_queueChanged.wait_until(lock, wakeUpTime);
+    }
+}
+
+//----------------------------------------------------------------------------//
+bool OutboundQueue::hasQueuedMessages() const
+{
+    return std::any_of(m_lanes.begin(), m_lanes.end(), [](const Lane& item) { return !item.messages.empty(); });
+}
+
+//----------------------------------------------------------------------------//
+bool OutboundQueue::hasUnsentMessages() const
+{
+    return hasQueuedMessages() ||
+        std::any_of(m_liveMessages.begin(), m_liveMessages.end(),
+                    [](const LiveMessages::value_type& liveMessage) { return liveMessage.second.hasUnsentText; });
+}
+
+//----------------------------------------------------------------------------//
+bool OutboundQueue::hasSendableMessages(std::chrono::steady_clock::time_point now)
+{
+    return std::any_of(m_lanes.begin(), m_lanes.end(), [&](Lane& item) { return findSendableMessage(item) != item.messages.end(); }) ||
+        findDueLiveMessage(now) != m_liveMessages.end();
+}
+
+//----------------------------------------------------------------------------//
+void OutboundQueue::dropUnsentMessages()
+{
+    for (auto& lane : m_lanes)
+    {
+        lane.statistics.failedCount += lane.messages.size();
+        m_droppedMessagesCount += lane.messages.size();
+        lane.messages.clear();
+    }
+
+    for (auto it = m_liveMessages.begin(); it != m_liveMessages.end();)
+    {
+        if (it->second.hasUnsentText)
+        {
+            ++m_lanes[laneIndex(MessagePriority::eNormal)].statistics.failedCount;
+            ++m_droppedMessagesCount;
+        }
+        it = m_liveMessages.erase(it);
+    }
+}
+
+//----------------------------------------------------------------------------//
+size_t OutboundQueue::dropNextParts(const Message& failedPart)
+{
+    if (failedPart.partsGroupId == 0)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // the chat is still in flight, so no other sender takes its parts meanwhile
+    size_t droppedCount = 0;
+    for (auto& lane : m_lanes)
+    {
+        const auto partsEnd = std::remove_if(lane.messages.begin(), lane.messages.end(), [&](const QueuedMessage& queuedMessage)
+        {
+            return queuedMessage.message.chatId == failedPart.chatId &&
+                queuedMessage.message.partsGroupId == failedPart.partsGroupId;
+        });
+        const auto laneDroppedCount = static_cast<size_t>(std::distance(partsEnd, lane.messages.end()));
+        lane.messages.erase(partsEnd, lane.messages.end());
+        lane.statistics.failedCount += laneDroppedCount;
+        droppedCount += laneDroppedCount;
+    }
+    return droppedCount;
+}
+
+//----------------------------------------------------------------------------//
+OutboundQueue::QueuedMessages::iterator OutboundQueue::findSendableMessage(Lane& lane)
+{
+    return std::find_if(lane.messages.begin(), lane.messages.end(), [&](const QueuedMessage& queuedMessage)
+    {
+        return m_chatsInFlight.count(queuedMessage.message.chatId) == 0;
+    });
+}
+
+//----------------------------------------------------------------------------//
+OutboundQueue::LiveMessages::iterator OutboundQueue::findDueLiveMessage(std::chrono::steady_clock::time_point now)
+{
+    const auto isDue = [&](const LiveMessages::value_type& liveMessage)
+    {
+        // on stop the unsent texts are sent without waiting for the interval
+        return liveMessage.second.hasUnsentText && (m_stopRequested || liveMessage.second.nextEditTime <= now) &&
+            m_chatsInFlight.count(liveMessage.first.first) == 0;
+    };
+
+    // messages are edited in turn, so the first ones can't hold the rest
+    const auto next = m_liveMessages.upper_bound(m_lastEditedLiveMessage);
+    const auto liveMessage = std::find_if(next, m_liveMessages.end(), isDue);
+    if (liveMessage != m_liveMessages.end())
+        return liveMessage;
+
+    const auto firstLiveMessage = std::find_if(m_liveMessages.begin(), next, isDue);
+    return firstLiveMessage == next ? m_liveMessages.end() : firstLiveMessage;
+}
+
+//----------------------------------------------------------------------------//
+std::chrono::steady_clock::time_point OutboundQueue::getNextLiveMessageEditTime() const
+{
+    auto nextEditTime = (std::chrono::steady_clock::time_point::max)();
+    for (const auto& [id, liveMessage] : m_liveMessages)
+    {
+        // edits of the chats being sent wait for the end of sending
+        if (liveMessage.hasUnsentText && m_chatsInFlight.count(id.first) == 0)
+            nextEditTime = (std::min)(nextEditTime, liveMessage.nextEditTime);
+    }
+    return nextEditTime;
+}
+
+//----------------------------------------------------------------------------//
+bool OutboundQueue::waitForRateBudget(std::unique_lock<std::mutex>& lock)
+{
+    while (true)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const std::chrono::duration<double> elapsed = now - m_lastRefill;
+        m_availableTokens = std::min<double>(m_messagesPerSecond,
+                                             m_availableTokens + elapsed.count() * m_messagesPerSecond);
+        m_lastRefill = now;
+
+        if (m_availableTokens >= 1.)
+            return true;
+
+        if (m_stopRequested && now >= m_stopDeadline)
+            return false;
+
+        const std::chrono::duration<double> timeToToken((1. - m_availableTokens) / m_messagesPerSecond);
+        auto wakeUpTime = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeToToken);
+        if (m_stopRequested)
+            wakeUpTime = (std::min)(wakeUpTime, m_stopDeadline);
+
+        // on stop we still send the messages left in the queue until the stop deadline,
+        // so only the rate limit change or the stop request wakes us earlier
+        const uint32_t currentLimit = m_messagesPerSecond;
+        const bool stopRequested = m_stopRequested;
+        m_rateLimitChanged.wait_until(lock, wakeUpTime, [&]()
+        {
+            return m_messagesPerSecond != currentLimit || m_stopRequested != stopRequested;
+        });
+    }
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_set>
+
+#include <ext/thread/thread.h>
+
+#include "TelegramThread.h"
+
+//----------------------------------------------------------------------------//
+// queue of the outgoing messages, messages are sent by the pool of sender threads by priority lanes
+// within the global rate budget:
+// - critical lane is served strictly before the others
+// - normal lane, bulk lane and live message edits share the remaining budget by weights
+// each message is addressed to one chat, so a fan-out to many chats can be preempted between the chats,
+// messages to the same chat are never sent in parallel to keep their order
+// live messages are edited in turn with the latest published text, each of them no more often than once per interval,
+// failed edit is repeated with growing interval up to kMaxEditRetriesCount times, edits rejected as bad request
+// or forbidden(message is deleted or too old, chat is gone, bot is blocked) are not repeated
+class OutboundQueue
+{
+public:
+    // outgoing message to one chat
+    struct Message
+    {
+        int64_t chatId = 0;
+        // UTF-8 text
+        std::string text;
+        bool disableWebPagePreview = false;
+        int32_t replyToMessageId = 0;
+        TgBot::GenericReply::Ptr replyMarkup;
+        std::string parseMode;
+        bool disableNotification = false;
+        // id shared by the parts of one split message, 0 if the message is not split
+        uint64_t partsGroupId = 0;
+    };
+
+    // callback on message sending error, the next parts of the failed split message are dropped without sending
+    typedef std::function<void(const Message& message, const std::exception& error, size_t droppedPartsCount)> SendErrorHandler;
+    // callback on the messages dropped without sending on the queue destruction
+    typedef std::function<void(size_t droppedCount)> DropHandler;
+
+    OutboundQueue(const TgBot::Api& api, SendErrorHandler errorHandler, DropHandler dropHandler);
+    // sends messages and live messages texts left in the queue in priority order for no longer than kStopTimeout,
+    // everything not sent in time is dropped and reported to the drop handler
+    ~OutboundQueue();
+
+    // add messages to the end of the lane
+    void Push(MessagePriority priority, std::list<Message>&& messages);
+    // get unique id for the parts of one split message, see Message::partsGroupId
+    uint64_t CreatePartsGroupId();
+
+    // set global limit of the sent messages per second
+    void SetRateLimit(uint32_t messagesPerSecond);
+
+    // publish the latest text of the live message, unsent previous text is replaced
+    void PublishLiveMessage(int64_t chatId, int32_t messageId, std::string&& text,
+                            const std::string& parseMode, TgBot::GenericReply::Ptr replyMarkup);
+    // stop tracking the live message after sending its unsent text
+    void RemoveLiveMessage(int64_t chatId, int32_t messageId);
+    // set min interval between edits of the same live message
+    void SetLiveMessageInterval(std::chrono::milliseconds interval);
+
+    // get statistics of the lane
+    SendLaneStatistics GetStatistics(MessagePriority priority) const;
+
+private:
+    // sender thread function
+    void senderThread();
+    // wait for the messages or live message edits to send, returns false if queue stopped and nothing left
+    bool waitForWork(std::unique_lock<std::mutex>& lock);
+    // true if there are messages in any lane
+    bool hasQueuedMessages() const;
+    // true if there are messages or live message edits which are not sent yet
+    bool hasUnsentMessages() const;
+    // true if there are messages or live message edits which can be sent now
+    bool hasSendableMessages(std::chrono::steady_clock::time_point now);
+    // wait until the rate budget allows to send one more message, returns false if stop timeout expired
+    bool waitForRateBudget(std::unique_lock<std::mutex>& lock);
+    // drop all messages and live messages texts which were not sent before the stop timeout
+    void dropUnsentMessages();
+    // drop the next parts of the failed split message to the same chat, called without the locked mutex
+    size_t dropNextParts(const Message& failedPart);
+
+private:
+    // message in the lane
+    struct QueuedMessage
+    {
+        Message message;
+        std::chrono::steady_clock::time_point enqueueTime;
+    };
+    typedef std::deque<QueuedMessage> QueuedMessages;
+    // lane with messages of the same priority
+    struct Lane
+    {
+        QueuedMessages messages;
+        SendLaneStatistics statistics;
+        // sum of all latencies, used for average latency calculation
+        std::chrono::microseconds totalLatency{};
+    };
+    // message taken from the queue for sending
+    struct OutgoingMessage
+    {
+        QueuedMessage queuedMessage;
+        // lane the message is accounted in
+        size_t lane = 0;
+        // id of the edited live message, 0 if new message is sent
+        int32_t editedMessageId = 0;
+    };
+    // message which is edited with the latest published text
+    struct LiveMessage
+    {
+        // latest published content
+        std::string text;
+        std::string parseMode;
+        TgBot::GenericReply::Ptr replyMarkup;
+        // serialized markup, markup is usually created anew for each publication so it is compared by content
+        std::string replyMarkupJson;
+        // true if the published content differs from the sent one
+        bool hasUnsentText = false;
+        // time of the first publication after the last edit
+        std::chrono::steady_clock::time_point publishTime;
+        // content of the last edit
+        std::string sentText;
+        std::string sentParseMode;
+        std::string sentReplyMarkupJson;
+        // the earliest time of the next edit
+        std::chrono::steady_clock::time_point nextEditTime;
+        // edit is being sent
+        bool editInProgress = false;
+        // failed edits in a row, used for the retry interval
+        size_t failedEditsCount = 0;
+        // remove message after sending the unsent text
+        bool removeRequested = false;
+    };
+    // chat id and message id
+    typedef std::pair<int64_t, int32_t> LiveMessageId;
+    typedef std::map<LiveMessageId, LiveMessage> LiveMessages;
+
+    // sources of the messages sharing the budget left from the critical lane
+    enum class Source
+    {
+        eNormalLane,
+        eBulkLane,
+        eLiveMessages,
+        eCount
+    };
+
+    // choose the next message to send, returns false if there is nothing to send now
+    bool takeNextMessage(std::chrono::steady_clock::time_point now, OutgoingMessage& outgoing);
+    // take the first sendable message of the lane
+    bool takeLaneMessage(MessagePriority priority, OutgoingMessage& outgoing);
+    // take the edit of the due live message
+    bool takeLiveMessageEdit(std::chrono::steady_clock::time_point now, OutgoingMessage& outgoing);
+    // update live message after the edit, failed retryable edit is repeated later
+    void completeLiveMessageEdit(const LiveMessageId& id, bool sent, bool retryable, std::chrono::steady_clock::time_point now);
+
+    // find the first message in the lane which chat has no messages being sent
+    QueuedMessages::iterator findSendableMessage(Lane& lane);
+    // find live message which should be edited now, messages are taken in turn after the last edited one
+    LiveMessages::iterator findDueLiveMessage(std::chrono::steady_clock::time_point now);
+    // get time of the next live message edit, time_point::max() if there is nothing to edit
+    std::chrono::steady_clock::time_point getNextLiveMessageEditTime() const;
+
+    // how many messages each source sends in a round when all of them have messages to send, indexed by Source
+    static constexpr std::array<size_t, static_cast<size_t>(Source::eCount)> kSourceWeights = { 4, 1, 2 };
+    // max power of two the live message interval is multiplied by after the failed edits
+    static constexpr size_t kMaxEditRetryIntervalPower = 6;
+    // max number of the repeats of the failed live message edit
+    static constexpr size_t kMaxEditRetriesCount = 8;
+    // default Telegram limit for the bot, see https://core.telegram.org/bots/faq#my-bot-is-hitting-limits-how-do-i-avoid-this
+    static constexpr uint32_t kDefaultMessagesPerSecond = 30;
+    static constexpr std::chrono::milliseconds kDefaultLiveMessageInterval{ 1000 };
+    // number of the messages sent in parallel, one sender can't use the rate budget because of the request round trip
+    static constexpr size_t kSenderThreadsCount = 4;
+    // max time of sending the messages left in the queue on destruction
+    static constexpr std::chrono::seconds kStopTimeout{ 5 };
+
+    const TgBot::Api& m_api;
+    const SendErrorHandler m_errorHandler;
+    const DropHandler m_dropHandler;
+
+    mutable std::mutex m_mutex;
+    // messages to send appeared, waited by the idle senders
+    std::condition_variable m_queueChanged;
+    // rate limit changed or stop requested, waited by the senders waiting for the rate budget
+    std::condition_variable m_rateLimitChanged;
+    // lanes indexed by MessagePriority
+    std::array<Lane, 3> m_lanes;
+    // messages sent by each source in the current round, indexed by Source
+    std::array<size_t, static_cast<size_t>(Source::eCount)> m_sentInRound{};
+    // chats which messages are being sent
+    std::unordered_set<int64_t> m_chatsInFlight;
+
+    bool m_stopRequested = false;
+    // time after which messages left in the queue are dropped
+    std::chrono::steady_clock::time_point m_stopDeadline;
+    // messages dropped without sending on stop
+    size_t m_droppedMessagesCount = 0;
+    // the last id given to the parts of the split message
+    uint64_t m_lastPartsGroupId = 0;
+
+    // live messages with the edits interval
+    LiveMessages m_liveMessages;
+    std::chrono::milliseconds m_liveMessageInterval = kDefaultLiveMessageInterval;
+    // the last edited live message, the next one is searched after it
+    LiveMessageId m_lastEditedLiveMessage;
+    // serializes live messages markup
+    TgBot::TgTypeParser m_typeParser;
+
+    // token bucket for the rate limit, capacity is equal to messages per second
+    uint32_t m_messagesPerSecond = kDefaultMessagesPerSecond;
+    double m_availableTokens = kDefaultMessagesPerSecond;
+    std::chrono::steady_clock::time_point m_lastRefill = std::chrono::steady_clock::now();
+
+    // threads sending messages
+    std::array<ext::thread, kSenderThreadsCount> m_senderThreads;
+};
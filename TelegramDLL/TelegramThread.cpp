@@ -17,36 +17,61 @@
 #include <ext/core.h>
 
 #include <atlconv.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <regex>
 
 #include "TelegramThread.h"
+#include "AlertChannel.h"
+#include "InlineQueryHelper.h"
+#include "MessageSplitter.h"
+#include "OutboundQueue.h"
+#include "TrafficRecorder.h"
 
 using namespace TgBot;
 
+// create client for the requests to the telegram server
+std::unique_ptr<HttpClient> createHttpClient()
+{
+#ifdef HAVE_CURL
+    return std::make_unique<CurlHttpClient>();
+#else
+    return std::make_unique<BoostHttpOnlySslClient>();
+#endif // HAVE_CURL
+}
+
 // data structure for the thread to work
 struct WorkTelegramData
 {
+    // client for the requests to the server
+    std::unique_ptr<HttpClient> httpClient;
+    // client used by the bot, writes server responses to the log while recording
+    RecordingHttpClient recordingHttpClient;
+
     // bot
     Bot bot;
 
-#ifdef HAVE_CURL
-    // customer
-    curlHttpClient curlHttpClient;
-#endif //HAVE_CURL
+    // delivers errors to the alert handler
+    AlertChannel alertChannel;
 
-    // callback to receive an error
-    TelegramErrorHandler errorHandler;
+    // time of the StartTelegramThread call
+    std::chrono::steady_clock::time_point startTime;
+    // startup statistics, filled by the bot threads
+    StartupStatistics startupStatistics;
+    mutable std::mutex startupStatisticsMutex;
 
     // constructor
-    explicit WorkTelegramData(const std::string& token, TelegramErrorHandler errorHandlerFunction)
-        : bot(token
-#ifdef HAVE_CURL
-              , curlHttpClient
-#endif // HAVE_CURL
-        )
-        , errorHandler(std::move(errorHandlerFunction))
+    explicit WorkTelegramData(const std::string& token, TelegramAlertHandler alertHandler,
+                              std::unique_ptr<HttpClient> client)
+        : httpClient(client ? std::move(client) : createHttpClient())
+        , recordingHttpClient(*httpClient)
+        , bot(token, recordingHttpClient)
+        , alertChannel(std::move(alertHandler))
     {}
 };
 
@@ -55,7 +80,9 @@ class TelegramThread : public ITelegramThread
 {
 public:
     // token - bot token
-    explicit TelegramThread(const std::string& token, const TelegramErrorHandler& errorHandler = nullptr);
+    // httpClient - client for the requests to the server, by default requests go to network
+    explicit TelegramThread(const std::string& token, const TelegramAlertHandler& alertHandler = nullptr,
+                            std::unique_ptr<HttpClient> httpClient = nullptr);
 
     ~TelegramThread();
 
@@ -79,28 +106,100 @@ public:
     void SendMessage(int64_t chatId, const std::wstring& msg, bool disableWebPagePreview = false, int32_t replyToMessageId = 0,
                      GenericReply::Ptr replyMarkup = std::make_shared<GenericReply>(), const std::string& parseMode = "", bool disableNotification = false) override;
 
+    // send message to chats with the priority
+    void SendPriorityMessage(MessagePriority priority, const std::list<int64_t>& chatIds, const std::wstring& msg,
+                             bool disableWebPagePreview = false, int32_t replyToMessageId = 0,
+                             GenericReply::Ptr replyMarkup = std::make_shared<GenericReply>(), const std::string& parseMode = "",
+                             bool disableNotification = false) override;
+
+    // send a message to the chat with the priority
+    void SendPriorityMessage(MessagePriority priority, int64_t chatId, const std::wstring& msg,
+                             bool disableWebPagePreview = false, int32_t replyToMessageId = 0,
+                             GenericReply::Ptr replyMarkup = std::make_shared<GenericReply>(), const std::string& parseMode = "",
+                             bool disableNotification = false) override;
+
+    // set global limit of the messages sent per second
+    void SetSendRateLimit(uint32_t messagesPerSecond) override;
+
+    // get statistics of the outgoing messages with the priority
+    SendLaneStatistics GetSendStatistics(MessagePriority priority) const override;
+
+    // publish the latest text of the live message
+    void PublishLiveMessage(int64_t chatId, int32_t messageId, const std::wstring& text,
+                            const std::string& parseMode = "",
+                            GenericReply::Ptr replyMarkup = nullptr) override;
+    // stop tracking the live message
+    void RemoveLiveMessage(int64_t chatId, int32_t messageId) override;
+    // set min interval between edits of the same live message
+    void SetLiveMessageInterval(std::chrono::milliseconds interval) override;
+
+    // answer inline queries with the provider results
+    void SetInlineQueryHandler(const InlineQueryResultsProvider& provider,
+                               const InlineQueryOptions& options = InlineQueryOptions()) override;
+    // compute results of the queries in background
+    void PrecomputeInlineQueries(const std::list<std::wstring>& queries) override;
+
     // returns bot events to handle everything itself
     TgBot::EventBroadcaster& GetBotEvents() override;
 
     // get api bot
     const TgBot::Api& GetBotApi() override;
+
+    // get time spent on the bot start
+    StartupStatistics GetStartupStatistics() const override;
+
+    // start writing api responses to the log
+    void StartRecording(const std::wstring& logPath) override;
+    // stop writing api responses to the log
+    void StopRecording() override;
 public:
     // telegram bot workflow
     ext::thread m_telegramThread;
 
+    // bot commands setting, runs in background while bot is already polling updates
+    std::future<void> m_commandsSynchronization;
+
     // data required for the telegram to work
     WorkTelegramData m_telegramWorkData;
-};
 
-//----------------------------------------------------------------------------//
-// send an error notification to the parent
-void sendAlert(const TelegramErrorHandler& errorHandler, const char* format, ...);
-void sendAlert(const TelegramErrorHandler& errorHandler, const std::wstring& str);
+    // outgoing messages, declared after the bot data to be destroyed before it
+    OutboundQueue m_outboundQueue;
+
+    // inline queries answering, declared after the bot data to be destroyed before it
+    InlineQueryHelper m_inlineQueryHelper;
+    // inline queries listener is added to the bot events only once
+    std::once_flag m_inlineQueryListenerRegistration;
+};
 
 //----------------------------------------------------------------------------//
 TelegramThread::TelegramThread(const std::string& token,
-                               const TelegramErrorHandler& errorHandler /*= nullptr*/)
-    : m_telegramWorkData(token, errorHandler)
+                               const TelegramAlertHandler& alertHandler /*= nullptr*/,
+                               std::unique_ptr<HttpClient> httpClient /*= nullptr*/)
+    : m_telegramWorkData(token, alertHandler, std::move(httpClient))
+    , m_outboundQueue(m_telegramWorkData.bot.getApi(),
+                      [&alertChannel = m_telegramWorkData.alertChannel](const OutboundQueue::Message& message, const std::exception& e,
+                                                                        size_t droppedPartsCount)
+                      {
+                          OutputDebugStringA(std::string_sprintf("Error SendMessage: %s\n", e.what()).c_str());
+                          TelegramAlert alert = createAlert(TelegramAlertCode::eSendFailed, e, message.chatId);
+                          if (droppedPartsCount != 0)
+                              alert.details += std::string_sprintf(", %zu next parts of the message are not sent", droppedPartsCount);
+                          alertChannel.Push(std::move(alert));
+                      },
+                      [&alertChannel = m_telegramWorkData.alertChannel](size_t droppedCount)
+                      {
+                          TelegramAlert alert;
+                          alert.code = TelegramAlertCode::eMessagesDropped;
+                          alert.timestamp = std::chrono::system_clock::now();
+                          alert.repeatCount = droppedCount;
+                          alertChannel.Push(std::move(alert));
+                      })
+    , m_inlineQueryHelper(m_telegramWorkData.bot.getApi(),
+                          [&alertChannel = m_telegramWorkData.alertChannel](const std::exception& e)
+                          {
+                              OutputDebugStringA(std::string_sprintf("Error inline query: %s\n", e.what()).c_str());
+                              alertChannel.Push(createAlert(TelegramAlertCode::eInlineQueryFailed, e));
+                          })
 {
     // Removing thousands separator from locale, awoid boost::lexical_cast wrong conversion
     const std::locale baseLoc = std::locale("");
@@ -119,14 +218,33 @@ TelegramThread::~TelegramThread()
 // onAnyMessageCommand - code to be executed when any message is received
 UINT telegramWorkThread(WorkTelegramData* telegramData)
 {
+    // bot name is needed only for the log, don't hold the polling start because of it
+    const auto botInfoRequest = std::async(std::launch::async, [telegramData]()
+    {
+        try
+        {
+            OutputDebugStringA(std::string_sprintf("Bot username: %s\n", telegramData->bot.getApi().getMe()->username.c_str()).c_str());
+        }
+        catch (std::exception& e)
+        {
+            telegramData->alertChannel.Push(createAlert(TelegramAlertCode::eInitFailed, e));
+        }
+    });
+
     try
     {
-        OutputDebugStringA(std::string_sprintf("Bot username: %s\n", telegramData->bot.getApi().getMe()->username.c_str()).c_str());
+        // updates can't be received while webhook is set
         telegramData->bot.getApi().deleteWebhook();
     }
     catch (std::exception& e)
     {
-        sendAlert(telegramData->errorHandler, "Failed to init bot: %s\n", e.what());
+        telegramData->alertChannel.Push(createAlert(TelegramAlertCode::eInitFailed, e));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(telegramData->startupStatisticsMutex);
+        telegramData->startupStatistics.pollingStartTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - telegramData->startTime);
     }
 
     TgLongPoll longPoll(telegramData->bot);
@@ -140,7 +258,7 @@ UINT telegramWorkThread(WorkTelegramData* telegramData)
         catch (std::exception& e)
         {
             OutputDebugStringA(std::string_sprintf("error: %s\n", e.what()).c_str());
-            sendAlert(telegramData->errorHandler, "Failure in bot long poll: %s\n", e.what());
+            telegramData->alertChannel.Push(createAlert(TelegramAlertCode::eLongPollFailed, e));
 
             try
             {
@@ -162,45 +280,107 @@ bool isValidCommand(const std::string& command) {
     return std::regex_match(command, pattern);
 }
 
+// FNV-1a hash of the commands list
+uint64_t getCommandsHash(const std::vector<BotCommand::Ptr>& commands)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const auto addToHash = [&hash](const std::string& text)
+    {
+        // terminating zero separates the strings
+        for (size_t i = 0; i <= text.size(); ++i)
+        {
+            hash ^= static_cast<unsigned char>(text.c_str()[i]);
+            hash *= 1099511628211ull;
+        }
+    };
+    for (const auto& command : commands)
+    {
+        addToHash(command->command);
+        addToHash(command->description);
+    }
+    return hash;
+}
+
+// path to the file with the hash of the commands last set for the bot
+std::filesystem::path getCommandsCachePath(const std::string& token)
+{
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::temp_directory_path(error) / "TelegramDLL";
+    std::filesystem::create_directories(path, error);
+    // token must not be stored in the file system
+    return path / (std::to_string(std::hash<std::string>()(token)) + ".commands");
+}
+
+// set bot commands if they were changed since the last set
+void synchronizeCommands(WorkTelegramData* telegramData, const std::vector<BotCommand::Ptr>& commands)
+{
+    const uint64_t commandsHash = getCommandsHash(commands);
+    const std::filesystem::path cachePath = getCommandsCachePath(telegramData->bot.getToken());
+
+    uint64_t cachedHash = 0;
+    std::ifstream cache(cachePath);
+    const bool skipped = (cache >> cachedHash) && cachedHash == commandsHash;
+    cache.close();
+
+    if (!skipped)
+    {
+        try
+        {
+            // setMyCommands replaces the whole list, deleting is needed only to clear it
+            if (commands.empty())
+                telegramData->bot.getApi().deleteMyCommands();
+            else
+                telegramData->bot.getApi().setMyCommands(commands);
+
+            std::ofstream(cachePath, std::ios::trunc) << commandsHash;
+        }
+        catch (std::exception& e)
+        {
+            telegramData->alertChannel.Push(createAlert(TelegramAlertCode::eCommandsSyncFailed, e));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(telegramData->startupStatisticsMutex);
+    telegramData->startupStatistics.commandsSyncTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - telegramData->startTime);
+    telegramData->startupStatistics.commandsSyncSkipped = skipped;
+}
+
 //----------------------------------------------------------------------------//
 void TelegramThread::StartTelegramThread(const std::list<CommandInfo>& commandsList,
                                          const CommandCallback& onUnknownCommand /*= nullptr*/,
                                          const CommandCallback& OnNonCommandMessage /*= nullptr*/)
 {
-    try
-    {
-        m_telegramWorkData.bot.getApi().deleteMyCommands();
-    }
-    catch (...)
     {
+        std::lock_guard<std::mutex> lock(m_telegramWorkData.startupStatisticsMutex);
+        m_telegramWorkData.startTime = std::chrono::steady_clock::now();
+        m_telegramWorkData.startupStatistics = StartupStatistics();
     }
 
-    if (!commandsList.empty())
-    {
-        std::vector<TgBot::BotCommand::Ptr> commands;
-        commands.reserve(commandsList.size());
+    std::vector<TgBot::BotCommand::Ptr> commands;
+    commands.reserve(commandsList.size());
 
-        for (auto&& command : commandsList)
+    for (auto&& command : commandsList)
+    {
+        auto botCommand = std::make_shared<TgBot::BotCommand>();
+        botCommand->command = getUtf8Str(command.command);
+        if (!isValidCommand(botCommand->command))
         {
-            auto botCommand = std::make_shared<TgBot::BotCommand>();
-            botCommand->command = getUtf8Str(command.command);
-            if (!isValidCommand(botCommand->command))
-            {
-                throw std::invalid_argument(
-                    std::string_sprintf("Command '%s' doesn't follow the rule: 1-32 characters. Can contain only lowercase English letters, digits and underscores.", command.command));
-            }
-            botCommand->description = getUtf8Str(command.description);
-
-            m_telegramWorkData.bot.getEvents().onCommand(botCommand->command, command.callback);
-            commands.emplace_back(std::move(botCommand));
+            throw std::invalid_argument(
+                std::string_sprintf("Command '%s' doesn't follow the rule: 1-32 characters. Can contain only lowercase English letters, digits and underscores.", command.command));
         }
+        botCommand->description = getUtf8Str(command.description);
 
-        m_telegramWorkData.bot.getApi().setMyCommands(commands);
+        m_telegramWorkData.bot.getEvents().onCommand(botCommand->command, command.callback);
+        commands.emplace_back(std::move(botCommand));
     }
 
     m_telegramWorkData.bot.getEvents().onUnknownCommand(onUnknownCommand);
     m_telegramWorkData.bot.getEvents().onNonCommandMessage(OnNonCommandMessage);
 
+    // commands menu is not needed to handle updates, set it in parallel with the bot start
+    m_commandsSynchronization = std::async(std::launch::async, &synchronizeCommands, &m_telegramWorkData, std::move(commands));
+
     EXT_ASSERT(!m_telegramThread.joinable() && "   !");
     m_telegramThread.run(&telegramWorkThread, &m_telegramWorkData);
 }
@@ -221,9 +401,17 @@ std::list<std::pair<std::wstring, std::wstring>> TelegramThread::GetCommands() c
 //----------------------------------------------------------------------------//
 void TelegramThread::StopTelegramThread()
 {
-    m_telegramWorkData.errorHandler = nullptr;
     if (m_telegramThread.joinable())
         m_telegramThread.interrupt_and_join();
+    if (m_commandsSynchronization.valid())
+        m_commandsSynchronization.wait();
+}
+
+//----------------------------------------------------------------------------//
+StartupStatistics TelegramThread::GetStartupStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_telegramWorkData.startupStatisticsMutex);
+    return m_telegramWorkData.startupStatistics;
 }
 
 //----------------------------------------------------------------------------//
@@ -232,80 +420,184 @@ void TelegramThread::SendMessage(const std::list<int64_t>& chatIds, const std::w
                                  GenericReply::Ptr replyMarkup, const std::string& parseMode,
                                  bool disableNotification)
 {
-    // send message to all users
+    SendPriorityMessage(MessagePriority::eNormal, chatIds, msg, disableWebPagePreview,
+                        replyToMessageId, replyMarkup,
+                        parseMode, disableNotification);
+}
+
+//----------------------------------------------------------------------------//
+void TelegramThread::SendMessage(int64_t chatId, const std::wstring& msg,
+                                 bool disableWebPagePreview, int32_t replyToMessageId,
+                                 GenericReply::Ptr replyMarkup, const std::string& parseMode,
+                                 bool disableNotification)
+{
+    SendPriorityMessage(MessagePriority::eNormal, chatId, msg, disableWebPagePreview,
+                        replyToMessageId, replyMarkup,
+                        parseMode, disableNotification);
+}
+
+//----------------------------------------------------------------------------//
+void TelegramThread::SendPriorityMessage(MessagePriority priority, const std::list<int64_t>& chatIds, const std::wstring& msg,
+                                         bool disableWebPagePreview, int32_t replyToMessageId,
+                                         GenericReply::Ptr replyMarkup, const std::string& parseMode,
+                                         bool disableNotification)
+{
+    std::list<std::string> parts;
+    for (const auto& part : splitMessage(msg, parseMode))
+    {
+        parts.emplace_back(getUtf8Str(part));
+    }
+
+    // one message per chat, so urgent messages can overtake a long fan-out,
+    // parts of the message go one after another in the lane so they are sent in order,
+    // if one of them fails the next ones are dropped
+    const uint64_t partsGroupId = parts.size() > 1 ? m_outboundQueue.CreatePartsGroupId() : 0;
+    std::list<OutboundQueue::Message> messages;
     for (auto& chatId : chatIds)
     {
-        try
+        for (auto part = parts.begin(), end = parts.end(); part != end; ++part)
         {
-            m_telegramWorkData.bot.getApi().sendMessage(chatId, getUtf8Str(msg), disableWebPagePreview,
-                                                        replyToMessageId, replyMarkup,
-                                                        parseMode, disableNotification);
-        }
-        catch (std::exception& e)
-        {
-            OutputDebugStringA(std::string_sprintf("Error SendMessage: %s\n", e.what()).c_str());
-            sendAlert(m_telegramWorkData.errorHandler, "Failed to send message: %s\n", e.what());
+            const bool firstPart = part == parts.begin();
+            const bool lastPart = std::next(part) == end;
+            messages.emplace_back(OutboundQueue::Message{ chatId, *part, disableWebPagePreview,
+                                                          firstPart ? replyToMessageId : 0,
+                                                          lastPart ? replyMarkup : std::make_shared<GenericReply>(),
+                                                          parseMode, disableNotification, partsGroupId });
         }
     }
+    m_outboundQueue.Push(priority, std::move(messages));
 }
 
 //----------------------------------------------------------------------------//
-void TelegramThread::SendMessage(int64_t chatId, const std::wstring& msg,
-                                 bool disableWebPagePreview, int32_t replyToMessageId,
-                                 GenericReply::Ptr replyMarkup, const std::string& parseMode,
-                                 bool disableNotification)
+void TelegramThread::SendPriorityMessage(MessagePriority priority, int64_t chatId, const std::wstring& msg,
+                                         bool disableWebPagePreview, int32_t replyToMessageId,
+                                         GenericReply::Ptr replyMarkup, const std::string& parseMode,
+                                         bool disableNotification)
 {
     std::list<int64_t> chatIds;
     chatIds.push_back(chatId);
-    SendMessage(chatIds, msg, disableWebPagePreview,
-                replyToMessageId, replyMarkup,
-                parseMode, disableNotification);
+    SendPriorityMessage(priority, chatIds, msg, disableWebPagePreview,
+                        replyToMessageId, replyMarkup,
+                        parseMode, disableNotification);
 }
 
 //----------------------------------------------------------------------------//
-TgBot::EventBroadcaster& TelegramThread::GetBotEvents()
+void TelegramThread::SetSendRateLimit(uint32_t messagesPerSecond)
 {
-    return m_telegramWorkData.bot.getEvents();
+    m_outboundQueue.SetRateLimit(messagesPerSecond);
 }
 
 //----------------------------------------------------------------------------//
-const TgBot::Api& TelegramThread::GetBotApi()
+SendLaneStatistics TelegramThread::GetSendStatistics(MessagePriority priority) const
 {
-    return m_telegramWorkData.bot.getApi();
+    return m_outboundQueue.GetStatistics(priority);
 }
 
 //----------------------------------------------------------------------------//
-void sendAlert(const TelegramErrorHandler& errorHandler, const char* format, ...)
+void TelegramThread::PublishLiveMessage(int64_t chatId, int32_t messageId, const std::wstring& text,
+                                        const std::string& parseMode, GenericReply::Ptr replyMarkup)
 {
-    if (!errorHandler)
-        return;
+    m_outboundQueue.PublishLiveMessage(chatId, messageId, getUtf8Str(text), parseMode, std::move(replyMarkup));
+}
+
+//----------------------------------------------------------------------------//
+void TelegramThread::RemoveLiveMessage(int64_t chatId, int32_t messageId)
+{
+    m_outboundQueue.RemoveLiveMessage(chatId, messageId);
+}
+
+//----------------------------------------------------------------------------//
+void TelegramThread::SetLiveMessageInterval(std::chrono::milliseconds interval)
+{
+    m_outboundQueue.SetLiveMessageInterval(interval);
+}
 
-    va_list arg;
+//----------------------------------------------------------------------------//
+void TelegramThread::SetInlineQueryHandler(const InlineQueryResultsProvider& provider,
+                                           const InlineQueryOptions& options /*= InlineQueryOptions()*/)
+{
+    m_inlineQueryHelper.SetProvider(provider, options);
 
-    /* Compute length of original message */
-    va_start(arg, format);
-    const int len = vsnprintf(NULL, 0, format, arg);
-    va_end(arg);
+    std::call_once(m_inlineQueryListenerRegistration, [&]()
+    {
+        m_telegramWorkData.bot.getEvents().onInlineQuery([&helper = m_inlineQueryHelper](const InlineQuery::Ptr query)
+        {
+            helper.OnInlineQuery(query);
+        });
+    });
+}
 
-    /* Allocate space for original message */
-    std::string str;
-    str.resize(len + 1);
+//----------------------------------------------------------------------------//
+void TelegramThread::PrecomputeInlineQueries(const std::list<std::wstring>& queries)
+{
+    m_inlineQueryHelper.Precompute(queries);
+}
 
-    /* Write original message to string */
-    va_start(arg, format);
-    vsnprintf(str.data(), len + 1, format, arg);
-    va_end(arg);
+//----------------------------------------------------------------------------//
+TgBot::EventBroadcaster& TelegramThread::GetBotEvents()
+{
+    return m_telegramWorkData.bot.getEvents();
+}
+
+//----------------------------------------------------------------------------//
+const TgBot::Api& TelegramThread::GetBotApi()
+{
+    return m_telegramWorkData.bot.getApi();
+}
+
+//----------------------------------------------------------------------------//
+void TelegramThread::StartRecording(const std::wstring& logPath)
+{
+    m_telegramWorkData.recordingHttpClient.StartRecording(logPath);
+}
 
-    errorHandler(std::widen(str.c_str()));
+//----------------------------------------------------------------------------//
+void TelegramThread::StopRecording()
+{
+    m_telegramWorkData.recordingHttpClient.StopRecording();
 }
 
 //----------------------------------------------------------------------------//
-void sendAlert(const TelegramErrorHandler& errorHandler, const std::wstring& str)
+inline DLLIMPORT_EXPORT std::wstring FormatTelegramAlert(const TelegramAlert& alert)
 {
-    if (errorHandler)
-        errorHandler(str);
+    std::string text;
+    switch (alert.code)
+    {
+    case TelegramAlertCode::eInitFailed:
+        text = std::string_sprintf("Failed to init bot: %s", alert.details.c_str());
+        break;
+    case TelegramAlertCode::eLongPollFailed:
+        text = std::string_sprintf("Failure in bot long poll: %s", alert.details.c_str());
+        break;
+    case TelegramAlertCode::eCommandsSyncFailed:
+        text = std::string_sprintf("Failed to set bot commands: %s", alert.details.c_str());
+        break;
+    case TelegramAlertCode::eSendFailed:
+        text = std::string_sprintf("Failed to send message to chat %lld: %s", alert.chatId, alert.details.c_str());
+        break;
+    case TelegramAlertCode::eInlineQueryFailed:
+        text = std::string_sprintf("Failed to answer inline query: %s", alert.details.c_str());
+        break;
+    case TelegramAlertCode::eAlertsDropped:
+        return getUNICODEString(std::string_sprintf("%zu alerts were dropped because of their amount\n", alert.repeatCount));
+    case TelegramAlertCode::eMessagesDropped:
+        return getUNICODEString(std::string_sprintf("%zu messages were dropped on the bot destruction\n", alert.repeatCount));
+    default:
+        EXT_ASSERT(false && "Unknown alert code");
+        text = alert.details;
+        break;
+    }
+
+    if (alert.httpStatus != 0)
+        text += std::string_sprintf(" (HTTP %d)", alert.httpStatus);
+    if (alert.repeatCount != 0)
+        text += std::string_sprintf(" (repeated %zu times)", alert.repeatCount);
+    text += "\n";
+
+    return getUNICODEString(text);
 }
 
+//----------------------------------------------------------------------------//
 inline DLLIMPORT_EXPORT std::string getUtf8Str(const std::wstring& str)
 {
     return std::string(ATL::CW2A(str.c_str(), CP_UTF8));
@@ -371,12 +663,21 @@ inline DLLIMPORT_EXPORT std::wstring getUNICODEString(const std::string& utf8Str
     return cstr;*/
 }
 
+//----------------------------------------------------------------------------//
+// convert text error handler to the alerts handler
+TelegramAlertHandler getAlertHandler(const TelegramErrorHandler& errorHandler)
+{
+    if (!errorHandler)
+        return nullptr;
+    return [errorHandler](const TelegramAlert& alert) { errorHandler(FormatTelegramAlert(alert)); };
+}
+
 //----------------------------------------------------------------------------//
 inline DLLIMPORT_EXPORT ITelegramThreadPtr CreateTelegramThread(const std::string& token,
                                                                 ITelegramAlerter* alertInterface /*= nullptr*/)
 {
     if (alertInterface)
-        return std::make_shared<TelegramThread>(token, std::bind(&ITelegramAlerter::onAlertFromTelegram, alertInterface, std::placeholders::_1));
+        return std::make_shared<TelegramThread>(token, std::bind(&ITelegramAlerter::onStructuredAlertFromTelegram, alertInterface, std::placeholders::_1));
     else
         return std::make_shared<TelegramThread>(token);
 }
@@ -385,7 +686,18 @@ inline DLLIMPORT_EXPORT ITelegramThreadPtr CreateTelegramThread(const std::strin
 inline DLLIMPORT_EXPORT ITelegramThreadPtr CreateTelegramThread(const std::string& token,
                                                                 const TelegramErrorHandler& alertHandler /*= nullptr*/)
 {
-    return std::make_unique<TelegramThread>(token, alertHandler);
+    return std::make_unique<TelegramThread>(token, getAlertHandler(alertHandler));
+}
+
+//----------------------------------------------------------------------------//
+inline DLLIMPORT_EXPORT ITelegramThreadPtr CreateReplayTelegramThread(const std::wstring& logPath,
+                                                                      ReplaySpeed speed /*= ReplaySpeed::eMaximum*/,
+                                                                      const TelegramErrorHandler& errorHandler /*= nullptr*/)
+{
+    auto telegramThread = std::make_shared<TelegramThread>("replay", getAlertHandler(errorHandler), std::make_unique<ReplayHttpClient>(logPath, speed));
+    // nothing goes to network, so handlers replies shouldn't be held by the Telegram rate limit
+    telegramThread->SetSendRateLimit((std::numeric_limits<uint32_t>::max)());
+    return telegramThread;
 }
 
 //----------------------------------------------------------------------------//
@@ -395,6 +707,13 @@ inline DLLIMPORT_EXPORT std::unique_ptr<TgBot::Bot> CreateTelegramBot(const std:
     return std::make_unique<TgBot::Bot>(token, client);
 }
 
+//----------------------------------------------------------------------------//
+inline DLLIMPORT_EXPORT std::list<std::wstring> SplitTelegramMessage(const std::wstring& msg,
+                                                                     const std::string& parseMode /*= ""*/)
+{
+    return splitMessage(msg, parseMode);
+}
+
 //----------------------------------------------------------------------------//
 inline DLLIMPORT_EXPORT void HandleTgUpdate(const TgBot::EventHandler& handler,
                                             TgBot::Update::Ptr update)
@@ -402,6 +721,50 @@ inline DLLIMPORT_EXPORT void HandleTgUpdate(const TgBot::EventHandler& handler,
     handler.handleUpdate(update);
 }
 
+//----------------------------------------------------------------------------//
+inline DLLIMPORT_EXPORT ReplayStatistics ReplayTelegramUpdates(const std::wstring& logPath,
+                                                               const TgBot::EventBroadcaster& events,
+                                                               ReplaySpeed speed /*= ReplaySpeed::eMaximum*/)
+{
+    const ReplayHttpClient replayClient(logPath, speed);
+    const Bot bot("replay", replayClient);
+    const EventHandler handler(events);
+
+    ReplayStatistics statistics;
+    const auto start = std::chrono::steady_clock::now();
+    while (!replayClient.IsUpdatesExhausted())
+    {
+        std::vector<Update::Ptr> updates;
+        try
+        {
+            updates = bot.getApi().getUpdates();
+        }
+        catch (const std::exception& e)
+        {
+            // server errors are recorded too, the bot long poll skips them in the same way
+            ++statistics.failedRequestsCount;
+            OutputDebugStringA(std::string_sprintf("Updates request replay failed: %s\n", e.what()).c_str());
+            continue;
+        }
+
+        for (auto& update : updates)
+        {
+            ++statistics.updatesCount;
+            try
+            {
+                HandleTgUpdate(handler, update);
+            }
+            catch (const std::exception& e)
+            {
+                ++statistics.failedUpdatesCount;
+                OutputDebugStringA(std::string_sprintf("Update %d replay failed: %s\n", update->updateId, e.what()).c_str());
+            }
+        }
+    }
+    statistics.duration = std::chrono::steady_clock::now() - start;
+    return statistics;
+}
+
 /*
 // CURL
 #include "curl/curl.h"
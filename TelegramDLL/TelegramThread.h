@@ -15,10 +15,12 @@
     #define DLLIMPORT_EXPORT __declspec(dllimport)
 #endif
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <functional>
 #include <list>
+#include <vector>
 
 #pragma warning( push )
 #pragma warning( disable: 4996 ) // boost deprecated objects usage
@@ -31,19 +33,144 @@ inline DLLIMPORT_EXPORT std::string getUtf8Str(const std::wstring& str);
 // convert UTF-8 string to std::wstring
 inline DLLIMPORT_EXPORT std::wstring getUNICODEString(const std::string& utf8Str);
 
-//------------------------------------------------ ----------------------//
+//----------------------------------------------------------------------------//
+// kind of the error in the work of the telegram bot, new codes are added to the end to keep the values
+enum class TelegramAlertCode
+{
+    eInitFailed,            // failed to init bot before the long poll
+    eLongPollFailed,        // failed to receive updates
+    eSendFailed,            // failed to send message
+    eAlertsDropped,         // alerts were not delivered because of their amount, repeatCount holds the number
+    eCommandsSyncFailed,    // failed to set bot commands
+    eInlineQueryFailed,     // failed to compute results or answer inline query
+    eMessagesDropped        // messages were not sent because of the bot destruction, repeatCount holds the number
+};
+
+// error in the work of the telegram bot
+struct TelegramAlert
+{
+    TelegramAlertCode code = TelegramAlertCode::eInitFailed;
+    // HTTP status returned by Telegram, 0 if error is not from the server
+    int httpStatus = 0;
+    // chat the error is related to, 0 if none
+    int64_t chatId = 0;
+    // time of the error
+    std::chrono::system_clock::time_point timestamp;
+    // error description, UTF-8
+    std::string details;
+    // how many times the same alert was repeated since the previous delivery
+    size_t repeatCount = 0;
+};
+
+// get text description of the alert
+inline DLLIMPORT_EXPORT std::wstring FormatTelegramAlert(const TelegramAlert& alert);
+
+//----------------------------------------------------------------------------//
 // interface used to receive notifications from the telegram bot
+// notifications come from the separate thread, same notifications are deduplicated and rate limited
 struct DLLIMPORT_EXPORT ITelegramAlerter
 {
     virtual ~ITelegramAlerter() = default;
     // notification of an error in the work of the telegram bot
     virtual void onAlertFromTelegram(const std::wstring& alertMessage) = 0;
+    // notification of an error with all its details, by default passes formatted alert to onAlertFromTelegram
+    virtual void onStructuredAlertFromTelegram(const TelegramAlert& alert) { onAlertFromTelegram(FormatTelegramAlert(alert)); }
 };
 
 typedef std::function<void(const std::wstring&)> TelegramErrorHandler;
+typedef std::function<void(const TelegramAlert&)> TelegramAlertHandler;
 typedef TgBot::Message::Ptr MessagePtr;
 typedef TgBot::EventBroadcaster::MessageListener CommandCallback;
 
+// priority of the outgoing message, critical messages are always sent first,
+// normal and bulk messages share the rest of the rate budget by weights
+enum class MessagePriority
+{
+    eCritical,  // alarms, preempt everything else
+    eNormal,    // regular messages
+    eBulk       // broadcasts to many chats
+};
+
+// statistics of the outgoing messages with the same priority
+struct SendLaneStatistics
+{
+    // messages waiting to be sent
+    size_t queuedCount = 0;
+    // successfully sent messages
+    size_t sentCount = 0;
+    // messages failed to send or dropped
+    size_t failedCount = 0;
+    // average time from SendMessage call to the server response
+    std::chrono::microseconds averageLatency{};
+    // maximum time from SendMessage call to the server response
+    std::chrono::microseconds maxLatency{};
+};
+
+// time spent on the bot start, counted from the StartTelegramThread call
+struct StartupStatistics
+{
+    // time to the first updates request
+    std::chrono::milliseconds pollingStartTime{};
+    // time to the end of the bot commands setting, 0 if it is still in progress
+    std::chrono::milliseconds commandsSyncTime{};
+    // commands were not changed since the last start and were not sent to the server
+    bool commandsSyncSkipped = false;
+};
+
+// speed of the recorded traffic replay
+enum class ReplaySpeed
+{
+    eRealTime,  // keep recorded intervals between the updates
+    eMaximum    // feed updates without delays
+};
+
+// result of the recorded traffic replay
+struct ReplayStatistics
+{
+    // updates passed to the handlers
+    size_t updatesCount = 0;
+    // updates which handlers thrown an exception
+    size_t failedUpdatesCount = 0;
+    // updates requests answered with the recorded server error, they are skipped
+    size_t failedRequestsCount = 0;
+    // time spent on parsing and handling of all updates
+    std::chrono::nanoseconds duration{};
+};
+
+// page of the inline query results, Telegram accepts no more than 50 results per page
+struct InlineQueryResults
+{
+    std::vector<TgBot::InlineQueryResult::Ptr> results;
+    // offset of the next page, Telegram passes it in the query when the user scrolls the results, empty if there are no more results
+    std::string nextOffset;
+};
+
+// computes page of the inline query results, called from the separate threads, can be called in parallel for different queries
+// normalizedQuery - query text in lower case with single spaces between words
+// offset - offset of the requested page from InlineQueryResults::nextOffset, empty for the first page
+// query - query from the user, nullptr when results are precomputed for the cache
+// isCancelled - returns true when the results are not needed anymore(user typed a new query), computation can be aborted,
+// results computed without cancellation are cached even if the query is superseded
+typedef std::function<InlineQueryResults(const std::wstring& normalizedQuery,
+                                         const std::string& offset,
+                                         const TgBot::InlineQuery::Ptr& query,
+                                         const std::function<bool()>& isCancelled)> InlineQueryResultsProvider;
+
+// settings of the inline queries handling
+struct InlineQueryOptions
+{
+    // time to wait for the next keystroke of the user before computing results
+    std::chrono::milliseconds debounceTime{ 300 };
+    // time to keep results in the cache, also passed to Telegram as cache_time
+    std::chrono::seconds cacheTime{ 300 };
+    // max number of the cached queries results, 0 disables the cache
+    size_t cacheSize = 1000;
+    // results depend on the user, passed to Telegram as is_personal, results are cached per user and never precomputed
+    bool isPersonal = false;
+    // number of the query requests after which results for its prefixes are precomputed, 0 disables precomputation
+    size_t popularQueryThreshold = 10;
+};
+
 //----------------------------------------------------------------------------//
 struct DLLIMPORT_EXPORT ITelegramThread
 {
@@ -61,19 +188,21 @@ struct DLLIMPORT_EXPORT ITelegramThread
         // Callback for the command
         CommandCallback callback;
     };
-    // start thread and set callbacks
-    // will throw exception on API call error
+    // start thread and set callbacks, polling starts at once while commands are set in background,
+    // commands are not sent if they were not changed since the last start, errors are reported via alerts
+    // will throw exception if command is invalid
     virtual void StartTelegramThread(const std::list<CommandInfo>& commandsList,
                                      const CommandCallback& onUnknownCommand = nullptr,
                                      const CommandCallback& OnNonCommandMessage = nullptr) = 0;
 
     // stop thread
+    // outgoing messages queue is neither flushed nor stopped, queued messages are sent until the bot destruction
     virtual void StopTelegramThread() = 0;
 
     // Get current bot commands
     virtual std::list<std::pair<std::wstring, std::wstring>> GetCommands() const = 0;
 
-    // send message to chats
+    // send message to chats with the normal priority, see SendPriorityMessage
     virtual void SendMessage(const std::list<int64_t>& chatIds, const std::wstring& msg,
                              bool disableWebPagePreview = false, int32_t replyToMessageId = 0,
                              TgBot::GenericReply::Ptr replyMarkup = std::make_shared<TgBot::GenericReply>(),
@@ -89,6 +218,60 @@ struct DLLIMPORT_EXPORT ITelegramThread
 
     // get api bot
     virtual const TgBot::Api& GetBotApi() = 0;
+
+    // new methods are added to the end to keep the layout of the exported interface
+
+    // get time spent on the bot start
+    virtual StartupStatistics GetStartupStatistics() const = 0;
+
+    // send message to chats with the priority
+    // message is queued and sent from the separate threads, sending errors are reported via alerts,
+    // on the bot destruction queued messages are still sent in priority order for a few seconds, the rest are dropped and reported
+    // message longer than Telegram limit is split to parts(see SplitTelegramMessage) which are sent in order,
+    // reply is set for the first part and markup for the last one, if a part fails the next parts to the chat are dropped
+    virtual void SendPriorityMessage(MessagePriority priority, const std::list<int64_t>& chatIds, const std::wstring& msg,
+                                     bool disableWebPagePreview = false, int32_t replyToMessageId = 0,
+                                     TgBot::GenericReply::Ptr replyMarkup = std::make_shared<TgBot::GenericReply>(),
+                                     const std::string& parseMode = "", bool disableNotification = false) = 0;
+
+    virtual void SendPriorityMessage(MessagePriority priority, int64_t chatId, const std::wstring& msg,
+                                     bool disableWebPagePreview = false, int32_t replyToMessageId = 0,
+                                     TgBot::GenericReply::Ptr replyMarkup = std::make_shared<TgBot::GenericReply>(),
+                                     const std::string& parseMode = "", bool disableNotification = false) = 0;
+
+    // set global limit of the messages sent per second, 30 by default
+    virtual void SetSendRateLimit(uint32_t messagesPerSecond) = 0;
+
+    // get statistics of the outgoing messages with the priority
+    virtual SendLaneStatistics GetSendStatistics(MessagePriority priority) const = 0;
+
+    // publish the latest text of the live message(status, dashboard) which is updated often
+    // only the latest text is kept, the message is edited no more often than once per live message interval
+    // and only if the text or markup(compared by content) differs from the last sent one,
+    // failed edit is repeated later a few times, edits rejected by Telegram as bad request or forbidden are not repeated,
+    // edits share the send budget with normal and bulk messages
+    // and are accounted in the normal priority statistics
+    virtual void PublishLiveMessage(int64_t chatId, int32_t messageId, const std::wstring& text,
+                                    const std::string& parseMode = "",
+                                    TgBot::GenericReply::Ptr replyMarkup = nullptr) = 0;
+    // stop tracking the live message, the last published text is still sent, but its failed edit is not repeated
+    virtual void RemoveLiveMessage(int64_t chatId, int32_t messageId) = 0;
+    // set min interval between edits of the same live message, 1 second by default
+    virtual void SetLiveMessageInterval(std::chrono::milliseconds interval) = 0;
+
+    // answer inline queries with the provider results
+    // queries are debounced per user, results are cached by the normalized query text and answered from the separate threads,
+    // errors are reported via alerts, calling again replaces the provider and clears the cache
+    virtual void SetInlineQueryHandler(const InlineQueryResultsProvider& provider,
+                                       const InlineQueryOptions& options = InlineQueryOptions()) = 0;
+    // compute results of the queries in background to answer them from the cache
+    virtual void PrecomputeInlineQueries(const std::list<std::wstring>& queries) = 0;
+
+    // start writing all api responses(including updates) to the binary log, see ReplayTelegramUpdates
+    // will throw exception if file can't be opened
+    virtual void StartRecording(const std::wstring& logPath) = 0;
+    // stop writing api responses to the log
+    virtual void StopRecording() = 0;
 };
 typedef std::shared_ptr<ITelegramThread> ITelegramThreadPtr;
 
@@ -102,11 +285,33 @@ inline DLLIMPORT_EXPORT
 ITelegramThreadPtr CreateTelegramThread(const std::string& botToken,
                                         const TelegramErrorHandler& errorHandler = nullptr);
 
+// create an instance of our class which never goes to network, all api calls are answered from the log
+// written by ITelegramThread::StartRecording, updates are received with the given speed after start,
+// sent messages are not rate limited
+// will throw exception if log can't be read
+inline DLLIMPORT_EXPORT
+ITelegramThreadPtr CreateReplayTelegramThread(const std::wstring& logPath,
+                                              ReplaySpeed speed = ReplaySpeed::eMaximum,
+                                              const TelegramErrorHandler& errorHandler = nullptr);
+
 // create an instance of the telegram bot
 inline DLLIMPORT_EXPORT
 std::unique_ptr<TgBot::Bot> CreateTelegramBot(const std::string& botToken,
                                               const TgBot::HttpClient& client);
 
+// split message to parts which fit Telegram limit of 4096 UTF-16 units of the text shown to the user
+// parts are cut on line breaks, spaces or entity boundaries, parseMode formatting is closed and reopened between parts
+inline DLLIMPORT_EXPORT
+std::list<std::wstring> SplitTelegramMessage(const std::wstring& msg, const std::string& parseMode = "");
+
 // handle update event from telegram channel
 inline DLLIMPORT_EXPORT
 void HandleTgUpdate(const TgBot::EventHandler& handler, TgBot::Update::Ptr update);
+
+// pass all updates from the log written by ITelegramThread::StartRecording to the handlers of events
+// without network, use CreateReplayTelegramThread events to answer handlers api calls from the log too
+// recorded server errors of the updates requests are skipped and counted
+// will throw exception if log can't be read
+inline DLLIMPORT_EXPORT
+ReplayStatistics ReplayTelegramUpdates(const std::wstring& logPath, const TgBot::EventBroadcaster& events,
+                                       ReplaySpeed speed = ReplaySpeed::eMaximum);
@@ -0,0 +1,184 @@
+#include "stdafx.h"
+
+#include <thread>
+
+#include "TrafficRecorder.h"
+
+namespace {
+
+constexpr char kLogSignature[] = { 'T', 'G', 'R', 'L' };
+constexpr uint32_t kLogVersion = 1;
+
+constexpr char kGetUpdatesMethod[] = "getUpdates";
+// answer to getUpdates when all recorded updates are returned
+constexpr char kNoUpdatesResponse[] = R"({"ok":true,"result":[]})";
+// answer to the method which never was recorded
+constexpr char kDefaultResponse[] = R"({"ok":true,"result":true})";
+
+// get api method name from the url path "/bot<token>/<method>", token must never get into the log
+std::string getMethodName(const TgBot::Url& url)
+{
+    const auto pos = url.path.find_last_of('/');
+    return pos == std::string::npos ? url.path : url.path.substr(pos + 1);
+}
+
+template <typename T>
+void writeValue(std::ostream& stream, const T& value)
+{
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool readValue(std::istream& stream, T& value)
+{
+    return !!stream.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------//
+RecordingHttpClient::RecordingHttpClient(TgBot::HttpClient& client)
+    : m_client(client)
+{}
+
+//----------------------------------------------------------------------------//
+void RecordingHttpClient::StartRecording(const std::filesystem::path& logPath)
+{
+    std::lock_guard<std::mutex> lock(m_logMutex);
+    if (m_log.is_open())
+        m_log.close();
+
+    m_log.open(logPath, std::ios::binary | std::ios::trunc);
+    if (!m_log.is_open())
+        throw std::runtime_error("Failed to open traffic log " + logPath.u8string());
+
+    m_log.write(kLogSignature, sizeof(kLogSignature));
+    writeValue(m_log, kLogVersion);
+    m_recordingStart = std::chrono::steady_clock::now();
+}
+
+//----------------------------------------------------------------------------//
+void RecordingHttpClient::StopRecording()
+{
+    std::lock_guard<std::mutex> lock(m_logMutex);
+    if (m_log.is_open())
+        m_log.close();
+}
+
+//----------------------------------------------------------------------------//
+std::string RecordingHttpClient::makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const
+{
+    // long poll changes timeout of the client used by the bot, requests come from several threads
+    // so the timeout is copied to the real client only when it changes
+    {
+        std::lock_guard<std::mutex> lock(m_logMutex);
+        if (m_client._timeout != _timeout)
+            m_client._timeout = _timeout;
+    }
+    std::string response = m_client.makeRequest(url, args);
+
+    std::lock_guard<std::mutex> lock(m_logMutex);
+    if (m_log.is_open())
+    {
+        const std::string method = getMethodName(url);
+        const auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - m_recordingStart);
+
+        writeValue(m_log, static_cast<uint64_t>(timestamp.count()));
+        writeValue(m_log, static_cast<uint16_t>(method.size()));
+        m_log.write(method.data(), method.size());
+        writeValue(m_log, static_cast<uint32_t>(response.size()));
+        m_log.write(response.data(), response.size());
+    }
+    return response;
+}
+
+//----------------------------------------------------------------------------//
+ReplayHttpClient::ReplayHttpClient(const std::filesystem::path& logPath, ReplaySpeed speed)
+    : m_speed(speed)
+{
+    std::ifstream log(logPath, std::ios::binary);
+    if (!log.is_open())
+        throw std::runtime_error("Failed to open traffic log " + logPath.u8string());
+
+    char signature[sizeof(kLogSignature)];
+    uint32_t version = 0;
+    if (!log.read(signature, sizeof(signature)) ||
+        !std::equal(std::begin(signature), std::end(signature), std::begin(kLogSignature)) ||
+        !readValue(log, version) || version != kLogVersion)
+        throw std::runtime_error("Unknown traffic log format " + logPath.u8string());
+
+    uint64_t timestamp;
+    while (readValue(log, timestamp))
+    {
+        uint16_t methodLength;
+        if (!readValue(log, methodLength))
+            break;
+        std::string method(methodLength, '\0');
+        if (!log.read(method.data(), methodLength))
+            break;
+
+        uint32_t responseLength;
+        if (!readValue(log, responseLength))
+            break;
+        std::string response(responseLength, '\0');
+        // the log could be cut if the recording process was killed, use everything we managed to read
+        if (!log.read(response.data(), responseLength))
+            break;
+
+        m_recordsByMethod[method].records.push_back(
+            Record{ std::chrono::microseconds(timestamp), std::move(response) });
+    }
+}
+
+//----------------------------------------------------------------------------//
+bool ReplayHttpClient::IsUpdatesExhausted() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_recordsByMethod.find(kGetUpdatesMethod);
+    return it == m_recordsByMethod.end() || it->second.nextRecord >= it->second.records.size();
+}
+
+//----------------------------------------------------------------------------//
+std::string ReplayHttpClient::makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& /*args*/) const
+{
+    const std::string method = getMethodName(url);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const auto it = m_recordsByMethod.find(method);
+    if (method != kGetUpdatesMethod)
+    {
+        if (it == m_recordsByMethod.end() || it->second.records.empty())
+            return kDefaultResponse;
+
+        auto& methodRecords = it->second;
+        const auto& record = methodRecords.records[(std::min)(methodRecords.nextRecord, methodRecords.records.size() - 1)];
+        ++methodRecords.nextRecord;
+        return record.response;
+    }
+
+    if (it == m_recordsByMethod.end() || it->second.nextRecord >= it->second.records.size())
+    {
+        lock.unlock();
+        // emulate an empty long poll to not spin the bot thread after the end of the log
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        return kNoUpdatesResponse;
+    }
+
+    auto& methodRecords = it->second;
+    const Record& record = methodRecords.records[methodRecords.nextRecord++];
+    if (m_speed == ReplaySpeed::eRealTime)
+    {
+        const auto& firstRecord = methodRecords.records.front();
+        if (!m_replayStarted)
+        {
+            m_replayStarted = true;
+            m_replayStart = std::chrono::steady_clock::now();
+        }
+        const auto sendTime = m_replayStart + (record.timestamp - firstRecord.timestamp);
+
+        lock.unlock();
+        std::this_thread::sleep_until(sendTime);
+    }
+    return record.response;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "TelegramThread.h"
+
+/*
+   Binary log of the Telegram API responses, all numbers are little endian:
+   header: "TGRL" uint32 version
+   record: uint64 microseconds from the recording start
+           uint16 method name length, method name (getUpdates, sendMessage, ...)
+           uint32 response length, raw JSON response
+*/
+
+//----------------------------------------------------------------------------//
+// http client which passes requests to the real client and writes responses to the log while recording is on
+class RecordingHttpClient : public TgBot::HttpClient
+{
+public:
+    explicit RecordingHttpClient(TgBot::HttpClient& client);
+
+    // start writing responses to the log file, throws on file open error
+    void StartRecording(const std::filesystem::path& logPath);
+    // stop writing responses and close the log
+    void StopRecording();
+
+    // TgBot::HttpClient
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override;
+
+private:
+    TgBot::HttpClient& m_client;
+
+    // guards the log and the timeout of the real client
+    mutable std::mutex m_logMutex;
+    mutable std::ofstream m_log;
+    std::chrono::steady_clock::time_point m_recordingStart;
+};
+
+//----------------------------------------------------------------------------//
+// http client which never goes to network and answers with the responses from the log
+// getUpdates responses are returned once in the recorded order, responses of the other
+// methods are returned in the recorded order and the last one is repeated after the end
+class ReplayHttpClient : public TgBot::HttpClient
+{
+public:
+    // throws if log can't be read
+    ReplayHttpClient(const std::filesystem::path& logPath, ReplaySpeed speed);
+
+    // true if all recorded updates are returned
+    bool IsUpdatesExhausted() const;
+
+    // TgBot::HttpClient
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override;
+
+private:
+    struct Record
+    {
+        std::chrono::microseconds timestamp;
+        std::string response;
+    };
+    // recorded responses of the method
+    struct MethodRecords
+    {
+        std::vector<Record> records;
+        size_t nextRecord = 0;
+    };
+
+    const ReplaySpeed m_speed;
+
+    mutable std::mutex m_mutex;
+    mutable std::unordered_map<std::string, MethodRecords> m_recordsByMethod;
+    // time of the first returned update, used for the real time pacing
+    mutable std::chrono::steady_clock::time_point m_replayStart;
+    mutable bool m_replayStarted = false;
+};
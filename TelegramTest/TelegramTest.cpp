@@ -143,8 +143,43 @@ void AddKeyboardWithCallbacks(ITelegramThread* pTelegramThread, std::list<ITeleg
     });
 }
 
-int main()
+// прогон записанного трафика через обработчики бота без сети, TelegramTest.exe replay <log>
+int ReplayRecordedTraffic(const std::wstring& logPath)
 {
+    try
+    {
+        ITelegramThreadPtr pTelegramThread = CreateReplayTelegramThread(logPath);
+
+        auto commands = FillCommands(pTelegramThread.get());
+        AddKeyboardWithCallbacks(pTelegramThread.get(), commands);
+        for (auto& command : commands)
+        {
+            pTelegramThread->GetBotEvents().onCommand(getUtf8Str(command.command), command.callback);
+        }
+
+        const ReplayStatistics statistics = ReplayTelegramUpdates(logPath, pTelegramThread->GetBotEvents());
+        const auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(statistics.duration).count();
+        std::cout << "Обработано обновлений: " << statistics.updatesCount
+                  << ", с ошибками: " << statistics.failedUpdatesCount
+                  << ", ошибок получения обновлений: " << statistics.failedRequestsCount
+                  << ", за " << durationMs << " мс" << std::endl;
+    }
+    catch (std::exception& exception)
+    {
+        std::cout << "Не обработанное исключение: " << exception.what();
+        return -1;
+    }
+
+    return 0;
+}
+
+// TelegramTest.exe [record <log>|replay <log>]
+int main(int argc, char* argv[])
+{
+    const std::string mode = argc == 3 ? argv[1] : "";
+    if (mode == "replay")
+        return ReplayRecordedTraffic(std::wstring(CA2W(argv[2])));
+
     InitAndSetInterrupter();
 
     std::string tokenStr;
@@ -179,6 +214,9 @@ int main()
 
     try
     {
+        if (mode == "record")
+            pTelegramThread->StartRecording(std::wstring(CA2W(argv[2])));
+
         pTelegramThread->StartTelegramThread(commands, onUnknownCommand, onNonCommandMessage);
 
         WaitForExecution();